@@ -0,0 +1,49 @@
+#include "Arena.h"
+#include <cstdlib>
+
+Arena::Arena(size_t chunkSize)
+        : buf(nullptr),
+          cap(chunkSize),
+          off(0)
+{
+}
+
+Arena::~Arena()
+{
+        Reset();
+        free(buf);
+}
+
+void *Arena::AllocateSlow(size_t n, size_t align)
+{
+        if (buf == nullptr && cap != 0) {
+                buf = (char *)malloc(cap);
+                if (buf == nullptr)
+                        cap = 0;
+        }
+        size_t start = (off + align - 1) & ~(align - 1);
+        if (align <= 16 && start + n <= cap && start + n >= start) {
+                off = start + n;
+                return buf + start;
+        }
+        void *p = nullptr;
+        if (align <= sizeof(void *)) {
+                p = malloc(n ? n : 1);
+        } else if (posix_memalign(&p, align, n ? n : 1) != 0) {
+                p = nullptr;
+        }
+        if (p == nullptr)
+                throw std::bad_alloc();
+        big.push_back(p);
+        return p;
+}
+
+void Arena::Reset()
+{
+        off = 0;
+        if (big.empty())
+                return;
+        for (auto p : big)
+                free(p);
+        big.clear();
+}
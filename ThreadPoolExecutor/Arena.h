@@ -0,0 +1,91 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <cstddef>
+#include <vector>
+#include <new>
+#include "ThreadPoolExecutor.h"
+
+/*
+  Bump pointer scratch memory of one worker. Every worker of a pool owns one
+  arena, reachable from inside a work with ThreadPoolExecutor::CurrentArena(),
+  and resets it after each work, so everything allocated from it is only
+  valid until the work returns. The chunk is allocated on first use, requests
+  that do not fit in it overflow to the heap and are freed by the reset.
+ */
+class Arena {
+public:
+        explicit Arena(size_t chunkSize);
+        ~Arena();
+        //align must be a power of 2
+        inline void *Allocate(size_t n, size_t align = 16) {
+                //chunk start comes from malloc, so aligning the offset is
+                //enough for align up to 16
+                size_t start = (off + align - 1) & ~(align - 1);
+                if (buf != nullptr && align <= 16 && start + n <= cap && start + n >= start) {
+                        off = start + n;
+                        return buf + start;
+                }
+                return AllocateSlow(n, align);
+        }
+        //drop everything allocated so far, only the worker should call this
+        void Reset();
+        //bytes handed out from the chunk since last reset
+        size_t GetUsed() const {return off;}
+        //number of allocations that overflowed to the heap since last reset
+        size_t GetOverflows() const {return big.size();}
+private:
+        Arena(const Arena &);
+        Arena &operator=(const Arena &);
+        char *buf;
+        size_t cap;
+        size_t off;
+        std::vector<void *> big;
+        void *AllocateSlow(size_t n, size_t align);
+};
+
+/*
+  STL allocator drawing from an arena, by default the arena of the calling
+  worker. Outside a worker, or with a null arena, it behaves like
+  std::allocator. deallocate() does not give memory back to the arena, the
+  reset at the end of the work does.
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+        typedef T value_type;
+        ArenaAllocator() : arena(ThreadPoolExecutor::CurrentArena()) {}
+        explicit ArenaAllocator(Arena *a) : arena(a) {}
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> &o) : arena(o.arena) {}
+        T *allocate(size_t n) {
+                if (arena == nullptr)
+                        return (T *)::operator new(n * sizeof(T));
+                return (T *)arena->Allocate(n * sizeof(T),
+                                            alignof(T) > 16 ? alignof(T) : 16);
+        }
+        void deallocate(T *p, size_t) {
+                if (arena == nullptr)
+                        ::operator delete(p);
+        }
+        template <typename U>
+        struct rebind {
+                typedef ArenaAllocator<U> other;
+        };
+        Arena *arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+        return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+        return a.arena != b.arena;
+}
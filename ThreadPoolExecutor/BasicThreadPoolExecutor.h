@@ -0,0 +1,451 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <deque>
+#include <cstdint>
+#include "ThreadPoolExecutor.h"
+
+/*
+  A lean pool assembled from policies at compile time, for the cases where
+  ThreadPoolExecutor pays for things that are never used: a fixed pool
+  never resizes, a pool that never sleeps needs no semaphore. Only the
+  members and branches of the chosen policies are compiled in.
+
+  QueuePolicy: where works wait
+        struct Config; Q(const Config &);
+        bool Push(Task &&t);//false when full
+        bool Pop(Task &t);//false when empty
+  WaitPolicy: how idle workers wait for works
+        u64 Prepare();//about to wait, called before the last Pop()
+        void Cancel(u64 ticket);//Pop() found a work after all
+        bool Wait(u64 ticket, u32 sec);//until Post() or sec(0 forever), false on timeout
+        void Post();//a work was pushed
+        void PostAll(u32 n);//wake all of the n workers
+  SizingPolicy: how many workers there are
+        struct Config; S(const Config &);
+        template<class P> void Start(P *pool);//start the first workers
+        template<class P> void OnExecute(P *pool);//a work was pushed
+        void BeginWork(); void EndWork();//around every work
+        u32 KeepAlive();//seconds an idle worker waits before Retire(), 0 forever
+        bool Retire();//an idle worker timed out, true to let it go, it
+                      //still runs what is queued before it leaves
+        u32 Size();
+        void Join();//after every worker left
+
+  The classic model is BasicThreadPoolExecutor<MutexQueue, ParkWait,
+  DynamicSizing>, a fixed pool on a lock free queue that never sleeps is
+  BasicThreadPoolExecutor<LockFreeQueue, SpinWait, FixedSizing>.
+  It is an Executor, calls through its own type are bound at compile time.
+  An exception escaping a work is caught by the worker and counted in
+  GetFailed().
+ */
+template<class QueuePolicy, class WaitPolicy, class SizingPolicy>
+class BasicThreadPoolExecutor final : public Executor {
+public:
+        typedef std::function<void()> Task;
+        explicit BasicThreadPoolExecutor(const typename SizingPolicy::Config &sc,
+                const typename QueuePolicy::Config &qc = typename QueuePolicy::Config())
+                : queue(qc), sizing(sc), state(RUNNING), entering(0), live(0), failed(0) {
+                sizing.Start(this);
+        }
+        //quits asap and waits for every worker
+        ~BasicThreadPoolExecutor() {
+                Shutdown(true);
+                AwaitTermination(0);
+                sizing.Join();
+        }
+        /*
+          return false when pool is quitting or the queue is full
+         */
+        bool Execute(const Task &task) override {
+                return Execute(Task(task));
+        }
+        bool Execute(Task &&task) {
+                //pairs with state then entering of a leaving worker, either
+                //we see the pool quit or it waits for our push
+                entering++;
+                bool ok = state.load() == RUNNING && queue.Push(std::move(task));
+                if (ok) {
+                        wait.Post();
+                        sizing.OnExecute(this);
+                }
+                entering--;
+                return ok;
+        }
+        //asap: works not started yet are dropped
+        void Shutdown(bool asap = false) {
+                int st = RUNNING;
+                if (asap)
+                        state = QUICK;
+                else
+                        state.compare_exchange_strong(st, QUITTING);
+                std::lock_guard<std::mutex> lk(lock);
+                wait.PostAll(live);
+        }
+        //sec 0 waits forever, return false on timeout
+        bool AwaitTermination(u32 sec = 0) {
+                std::unique_lock<std::mutex> lk(lock);
+                auto done = [this] {return live == 0;};
+                if (sec == 0) {
+                        quitCond.wait(lk, done);
+                        return true;
+                }
+                return quitCond.wait_for(lk, std::chrono::seconds(sec), done);
+        }
+        u32 GetPoolSize() {
+                return sizing.Size();
+        }
+        //works that threw
+        u64 GetFailed() {
+                return failed.load(std::memory_order_relaxed);
+        }
+private:
+        friend SizingPolicy;
+        enum {RUNNING, QUITTING, QUICK};
+        QueuePolicy queue;
+        WaitPolicy wait;
+        SizingPolicy sizing;
+        std::atomic<int> state;
+        std::atomic<u32> entering;//Execute() calls under way
+        std::mutex lock;
+        std::condition_variable quitCond;
+        u32 live;//workers not yet left
+        std::atomic<u64> failed;
+
+        void Work(Task &t) {
+                sizing.BeginWork();
+                //zero cost until something throws, like ThreadPoolExecutor
+                try {
+                        t();
+                } catch (...) {
+                        failed.fetch_add(1, std::memory_order_relaxed);
+                }
+                t = nullptr;
+                sizing.EndWork();
+        }
+        //the sizing policy calls this before starting a worker
+        void Enter() {
+                std::lock_guard<std::mutex> lk(lock);
+                live++;
+        }
+        void Run() {
+                Task t;
+                while (state.load(std::memory_order_relaxed) != QUICK) {
+                        if (queue.Pop(t)) {
+                                Work(t);
+                                continue;
+                        }
+                        u64 ticket = wait.Prepare();
+                        if (queue.Pop(t)) {
+                                wait.Cancel(ticket);
+                                Work(t);
+                                continue;
+                        }
+                        if (state.load() != RUNNING) {
+                                wait.Cancel(ticket);
+                                //works accepted before the pool quit may
+                                //still be on the way, they must run
+                                while (entering.load() != 0)
+                                        std::this_thread::yield();
+                                if (queue.Pop(t)) {
+                                        Work(t);
+                                        continue;
+                                }
+                                break;
+                        }
+                        if (!wait.Wait(ticket, sizing.KeepAlive()) && sizing.Retire()) {
+                                //an Execute() that still counted us spawned
+                                //nobody for its work, take it before we
+                                //leave. Pairs with Post(), which orders
+                                //the push before OnExecute() reads cur
+                                std::atomic_thread_fence(std::memory_order_seq_cst);
+                                while (state.load(std::memory_order_relaxed) != QUICK
+                                       && queue.Pop(t))
+                                        Work(t);
+                                break;
+                        }
+                }
+                std::lock_guard<std::mutex> lk(lock);
+                if (--live == 0)
+                        quitCond.notify_all();
+        }
+};
+
+/*
+  queue policies
+ */
+//std::deque under a mutex, unbounded
+class MutexQueue {
+public:
+        struct Config {};
+        explicit MutexQueue(const Config &) {}
+        bool Push(std::function<void()> &&t) {
+                std::lock_guard<std::mutex> lk(lock);
+                q.push_back(std::move(t));
+                return true;
+        }
+        bool Pop(std::function<void()> &t) {
+                std::lock_guard<std::mutex> lk(lock);
+                if (q.empty())
+                        return false;
+                t = std::move(q.front());
+                q.pop_front();
+                return true;
+        }
+private:
+        std::mutex lock;
+        std::deque<std::function<void()> > q;
+};
+
+//bounded MPMC ring, every cell carries a sequence number telling producers
+//and consumers whose turn it is, so neither side takes a lock
+class LockFreeQueue {
+public:
+        struct Config {
+                Config(u32 cap = 65536) : capacity(cap) {}
+                u32 capacity;//rounded up to a power of 2
+        };
+        explicit LockFreeQueue(const Config &cfg) : enq(0), deq(0) {
+                size_t cap = 2;
+                while (cap < cfg.capacity)
+                        cap <<= 1;
+                mask = cap - 1;
+                cells.reset(new Cell[cap]);
+                for (size_t i = 0; i < cap; i++)
+                        cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        bool Push(std::function<void()> &&t) {
+                size_t pos = enq.load(std::memory_order_relaxed);
+                Cell *c;
+                while (1) {
+                        c = &cells[pos & mask];
+                        size_t seq = c->seq.load(std::memory_order_acquire);
+                        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                        if (dif == 0) {
+                                if (enq.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                                        break;
+                        } else if (dif < 0) {
+                                return false;//full
+                        } else {
+                                pos = enq.load(std::memory_order_relaxed);
+                        }
+                }
+                c->fn = std::move(t);
+                c->seq.store(pos + 1, std::memory_order_release);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                return true;
+        }
+        bool Pop(std::function<void()> &t) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                size_t pos = deq.load(std::memory_order_relaxed);
+                Cell *c;
+                while (1) {
+                        c = &cells[pos & mask];
+                        size_t seq = c->seq.load(std::memory_order_acquire);
+                        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+                        if (dif == 0) {
+                                if (deq.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                                        break;
+                        } else if (dif < 0) {
+                                return false;//empty
+                        } else {
+                                pos = deq.load(std::memory_order_relaxed);
+                        }
+                }
+                t = std::move(c->fn);
+                c->fn = nullptr;
+                c->seq.store(pos + mask + 1, std::memory_order_release);
+                return true;
+        }
+private:
+        struct Cell {
+                std::atomic<size_t> seq;
+                std::function<void()> fn;
+        };
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        //producers and consumers on their own cache lines, padded by hand
+        //since new can not over-align before C++17
+        char pad0[64];
+        std::atomic<size_t> enq;
+        char pad1[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> deq;
+        char pad2[64 - sizeof(std::atomic<size_t>)];
+};
+
+/*
+  wait policies
+ */
+//park on a Semaphore, Post() only pays for it when a sleeper has no
+//wakeup on the way yet
+class ParkWait {
+public:
+        ParkWait() : sleepers(0), signals(0) {}
+        u64 Prepare() {
+                sleepers++;
+                return 0;
+        }
+        void Cancel(u64) {
+                sleepers--;
+        }
+        bool Wait(u64, u32 sec) {
+                bool r = sem.wait(sec);
+                //a post made after a timeout stays in sem for the next one
+                if (r)
+                        signals--;
+                sleepers--;
+                return r;
+        }
+        void Post() {
+                //pairs with Prepare() before the last Pop(), either we see
+                //the sleeper or it sees the work. A woken worker drains the
+                //queue before it sleeps again, one wakeup per sleeper is enough
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                int sig = signals.load();
+                while (sleepers.load() > sig) {
+                        if (signals.compare_exchange_weak(sig, sig + 1)) {
+                                sem.post();
+                                return;
+                        }
+                }
+        }
+        void PostAll(u32 n) {
+                signals += n;
+                for (u32 i = 0; i < n; i++)
+                        sem.post();
+        }
+private:
+        Semaphore sem;
+        std::atomic<int> sleepers;
+        std::atomic<int> signals;//posts not yet taken by a waiter
+};
+
+//never sleeps, polls a post counter with pause and then yield
+class SpinWait {
+public:
+        SpinWait() : tick(0) {}
+        u64 Prepare() {
+                return tick.load();
+        }
+        void Cancel(u64) {}
+        bool Wait(u64 ticket, u32 sec) {
+                auto until = std::chrono::steady_clock::now() + std::chrono::seconds(sec);
+                u32 backoff = 1;
+                while (tick.load(std::memory_order_relaxed) == ticket) {
+                        for (u32 i = 0; i < backoff; i++)
+                                cpu_relax();
+                        if (backoff < 64) {
+                                backoff <<= 1;
+                                continue;
+                        }
+                        std::this_thread::yield();
+                        if (sec != 0 && std::chrono::steady_clock::now() >= until)
+                                return false;
+                }
+                return true;
+        }
+        void Post() {
+                tick++;
+        }
+        void PostAll(u32) {
+                tick++;
+        }
+private:
+        std::atomic<u64> tick;
+};
+
+/*
+  sizing policies
+ */
+//n workers for the whole life of the pool
+class FixedSizing {
+public:
+        struct Config {
+                Config(u32 n = 1) : threads(n) {}
+                u32 threads;
+        };
+        explicit FixedSizing(const Config &cfg) : n(cfg.threads ? cfg.threads : 1) {}
+        template<class P> void Start(P *pool) {
+                for (u32 i = 0; i < n; i++) {
+                        pool->Enter();
+                        ths.emplace_back(&P::Run, pool);
+                }
+        }
+        template<class P> void OnExecute(P *) {}
+        void BeginWork() {}
+        void EndWork() {}
+        u32 KeepAlive() {return 0;}
+        bool Retire() {return false;}
+        u32 Size() {return n;}
+        void Join() {
+                for (auto &th : ths)
+                        th.join();
+        }
+private:
+        u32 n;
+        std::vector<std::thread> ths;
+};
+
+//grows up to max when works outnumber the workers, idle ones above min leave after
+//keepAliveSec, like ThreadPoolExecutor
+class DynamicSizing {
+public:
+        struct Config {
+                Config(u32 amin = 0, u32 amax = 0xffffffff, u32 alive = 60)
+                        : min(amin), max(amax), keepAliveSec(alive) {}
+                u32 min;
+                u32 max;
+                u32 keepAliveSec;
+        };
+        explicit DynamicSizing(const Config &cfg)
+                : min(cfg.min), max(cfg.max ? cfg.max : 1), atm(cfg.keepAliveSec),
+                  cur(0), busy(0), queued(0) {
+                assert(min <= max);
+        }
+        template<class P> void Start(P *pool) {
+                std::lock_guard<std::mutex> lk(lock);
+                while (cur < min)
+                        Add(pool);
+        }
+        template<class P> void OnExecute(P *pool) {
+                //more works than workers to take them
+                u32 need = ++queued + busy.load(std::memory_order_relaxed);
+                if (need <= cur.load(std::memory_order_relaxed))
+                        return;
+                std::lock_guard<std::mutex> lk(lock);
+                if (need > cur && cur < max)
+                        Add(pool);
+        }
+        void BeginWork() {
+                queued--;
+                busy++;
+        }
+        void EndWork() {busy--;}
+        u32 KeepAlive() {return atm;}
+        bool Retire() {
+                std::lock_guard<std::mutex> lk(lock);
+                if (cur <= min)
+                        return false;
+                cur--;
+                return true;
+        }
+        u32 Size() {return cur;}
+        //workers are detached, the pool waits for them to leave
+        void Join() {}
+private:
+        u32 min;
+        u32 max;
+        u32 atm;
+        std::mutex lock;
+        std::atomic<u32> cur;
+        std::atomic<u32> busy;
+        std::atomic<u32> queued;
+        template<class P> void Add(P *pool) {//this is already guarded by a lock
+                pool->Enter();
+                std::thread(&P::Run, pool).detach();
+                cur++;
+        }
+};
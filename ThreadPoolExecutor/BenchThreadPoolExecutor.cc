@@ -0,0 +1,680 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <atomic>
+using namespace std;
+
+#include "ThreadPoolExecutor.h"
+#include "Reactor.h"
+#include "Arena.h"
+#include "Pipeline.h"
+#include "BasicThreadPoolExecutor.h"
+#include "Parallel.h"
+#include "DurableQueue.h"
+#include "Workload.h"
+#include "Sync.h"
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
+
+typedef std::chrono::steady_clock bclock;
+
+inline double elapsed_sec(bclock::time_point t0)
+{
+        return std::chrono::duration<double>(bclock::now() - t0).count();
+}
+
+#ifdef __linux__
+void bench_reactor_echo()
+{//ping-pong one byte over loopback socket pairs, every hop is one event
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int P = 64;
+        const float T = 2;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        auto reactor = new Reactor(pool);
+        int sv[P][2];
+        std::atomic<bool> running(true);
+        auto echo =
+                [&] (int fd, u32 events) {
+                char c;
+                if (read(fd, &c, 1) == 1 && running && write(fd, &c, 1) == 1)
+                        reactor->Rearm(fd, EPOLLIN);
+        };
+        for (int i = 0; i < P; i++) {
+                socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]);
+                reactor->Add(sv[i][0], EPOLLIN, echo);
+                reactor->Add(sv[i][1], EPOLLIN, echo);
+        }
+        auto t0 = bclock::now();
+        for (int i = 0; i < P; i++) {
+                ssize_t r = write(sv[i][1], "x", 1);
+                (void)r;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds((int)(T * 1000)));
+        u64 n = reactor->GetDispatched();
+        double sec = elapsed_sec(t0);
+        running = false;
+        //handlers use the reactor, drain them before it goes away
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete reactor;
+        delete pool;
+        for (int i = 0; i < P; i++) {
+                close(sv[i][0]);
+                close(sv[i][1]);
+        }
+        cout << P << " pairs: " << (u64)(n / sec) << " events/sec" << endl;
+}
+#endif
+
+template <typename Alloc>
+double build_vectors(int works, int len)
+{
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        std::atomic<u64> sum(0);
+        auto t0 = bclock::now();
+        for (int i = 0; i < works; i++)
+                pool->Execute([&sum, len] () {
+                                std::vector<int, Alloc> v;
+                                for (int j = 0; j < len; j++)
+                                        v.push_back(j);
+                                sum += v.back();
+                        });
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        double sec = elapsed_sec(t0);
+        delete pool;
+        return sec;
+}
+
+void bench_arena_vector()
+{//short lived vectors built inside works, heap vs worker arena
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int W = 20000;
+        const int lens[] = {16, 256, 4096};
+        for (auto len : lens) {
+                double h = build_vectors<std::allocator<int> >(W, len);
+                double a = build_vectors<ArenaAllocator<int> >(W, len);
+                cout << W << " works x " << len << " push_back: std::allocator "
+                     << (u64)(W / h) << " works/sec, arena " << (u64)(W / a)
+                     << " works/sec, x" << h / a << endl;
+        }
+}
+
+void bench_million_tasks()
+{//test_fuck() load: a million tiny works on a fixed pool, with and without batching
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int N = 1024 * 1024;
+        const u32 threads[] = {4, 128};
+        const u32 batches[] = {1, 4, 16, 64};
+        for (auto nt : threads) {
+                for (auto mb : batches) {
+                        auto pool = ThreadPoolExecutor::NewFixedThreadPool(nt);
+                        pool->SetMaxBatch(mb);
+                        std::mutex gl;
+                        int val = 0;
+                        auto task =
+                                [&] () {
+                                gl.lock();
+                                val++;
+                                gl.unlock();
+                        };
+                        auto t0 = bclock::now();
+                        for (int i = 0; i < N; i++)
+                                pool->Execute(task);
+                        pool->Shutdown(false);
+                        pool->AwaitTermination(0);
+                        double sec = elapsed_sec(t0);
+                        auto st = pool->GetStats();
+                        delete pool;
+                        cout << nt << " threads, max batch " << mb << ": "
+                             << (u64)(N / sec) << " works/sec, avg batch "
+                             << (double)st.served / st.batches << endl;
+                }
+        }
+}
+
+void bench_lifo_wakeup()
+{//partial load on a big cached pool, LIFO vs rotating wakeup
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const u32 W = 16;
+        const float T = 3;
+        for (int lifo = 1; lifo >= 0; lifo--) {
+                auto pool = new ThreadPoolExecutor(0, W, 1);
+                pool->SetLifoWakeup(lifo);
+                pool->EnablePerfCounters();
+                //grow to W workers
+                for (u32 i = 0; i < W; i++)
+                        pool->Execute([] () {
+                                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                                });
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                //every work walks a 256K per-thread buffer, about one work per
+                //ms keeps a single worker busy at most
+                std::atomic<u64> ns(0);
+                auto walk =
+                        [&ns] () {
+                        static thread_local std::vector<char> buf(256 * 1024);
+                        auto w0 = bclock::now();
+                        for (size_t i = 0; i < buf.size(); i += 64)
+                                buf[i]++;
+                        ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                bclock::now() - w0).count();
+                };
+                auto t0 = bclock::now();
+                while (elapsed_sec(t0) < T) {
+                        pool->Execute(walk, "walk");
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                auto st = pool->GetStats();
+                for (auto &ps : st.perf) {
+                        if (string(ps.name) != "walk")
+                                continue;
+                        cout << (lifo ? "lifo" : "fifo") << ": " << st.poolSize
+                             << " of " << W << " threads left, per work "
+                             << ps.llcMisses / ps.works << " LLC misses "
+                             << ps.cycles / ps.works << " cycles "
+                             << ns / ps.works << " ns"
+                             << (st.perfAvailable ? "" : " (perf unavailable)") << endl;
+                }
+                delete pool;
+        }
+}
+
+void bench_spin_latency()
+{//submit to start latency of a single work on an idle pool, park vs spin
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int N = 2000;
+        struct {
+                const char *mode;
+                u32 spinUs;
+                u32 hot;
+        } modes[] = {
+                {"park", 0, 0},
+                {"spin 50us", 50, 0},
+                {"spin 1ms", 1000, 0},
+                {"1 hot worker", 0, 1},
+        };
+        for (auto &m : modes) {
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+                pool->SetSpinWait(m.spinUs, m.hot);
+                std::vector<u64> lat(N);
+                std::atomic<bool> started(false);
+                for (int i = 0; i < N; i++) {
+                        //let the workers go idle between two samples
+                        std::this_thread::sleep_for(std::chrono::microseconds(200));
+                        started = false;
+                        auto t0 = bclock::now();
+                        pool->Execute([&, i, t0] () {
+                                        lat[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                bclock::now() - t0).count();
+                                        started = true;
+                                });
+                        while (!started)
+                                std::this_thread::yield();
+                }
+                delete pool;
+                std::sort(lat.begin(), lat.end());
+                cout << m.mode << ": p50 " << lat[N / 2] << " ns, p99 "
+                     << lat[N * 99 / 100] << " ns, max " << lat[N - 1] << " ns" << endl;
+        }
+}
+
+void bench_pipeline()
+{//parse, transform, compress, write with a slow writer: a pool per stage
+ //with unbounded queues vs a Pipeline bounded to 16 tokens on one pool
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int N = 2000;
+        const size_t SZ = 64 * 1024;
+        std::atomic<int> live(0), peak(0);
+        auto make =
+                [&] () {
+                int l = ++live;
+                for (int p = peak; l > p && !peak.compare_exchange_weak(p, l);)
+                        ;
+                return new std::vector<char>(SZ, 1);
+        };
+        auto crunch =
+                [] (std::vector<char> *v) {
+                for (size_t i = 1; i < v->size(); i++)
+                        (*v)[i] ^= (*v)[i - 1];
+        };
+        auto write =
+                [&] (std::vector<char> *v) {
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+                delete v;
+                live--;
+        };
+        {
+                peak = 0;
+                auto t0 = bclock::now();
+                auto tp = ThreadPoolExecutor::NewFixedThreadPool(2);
+                auto cp = ThreadPoolExecutor::NewFixedThreadPool(2);
+                auto wp = ThreadPoolExecutor::NewSingleThreadExecutor();
+                for (int i = 0; i < N; i++) {
+                        auto v = make();
+                        tp->Execute([=] () {
+                                        crunch(v);
+                                        cp->Execute([=] () {
+                                                        crunch(v);
+                                                        wp->Execute(std::bind(write, v));
+                                                });
+                                });
+                }
+                for (auto p : {tp, cp, wp}) {
+                        p->Shutdown(false);
+                        p->AwaitTermination(0);
+                        delete p;
+                }
+                double sec = elapsed_sec(t0);
+                cout << "pool per stage: " << (u64)(N / sec) << " items/sec, peak "
+                     << peak * SZ / 1024 << " KB in flight" << endl;
+        }
+        for (u32 tokens : {4, 16, 64}) {
+                peak = 0;
+                auto t0 = bclock::now();
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+                Pipeline pl(pool, tokens);
+                int n = 0;
+                pl.AddStage(Pipeline::SERIAL_IN_ORDER, [&] (void *) -> void * {
+                                return n++ < N ? make() : nullptr;
+                        });
+                pl.AddStage(Pipeline::PARALLEL, [&] (void *p) -> void * {
+                                crunch((std::vector<char> *)p);
+                                return p;
+                        });
+                pl.AddStage(Pipeline::PARALLEL, [&] (void *p) -> void * {
+                                crunch((std::vector<char> *)p);
+                                return p;
+                        });
+                pl.AddStage(Pipeline::SERIAL_IN_ORDER, [&] (void *p) -> void * {
+                                write((std::vector<char> *)p);
+                                return nullptr;
+                        });
+                pl.Run();
+                double sec = elapsed_sec(t0);
+                delete pool;
+                cout << "pipeline, " << tokens << " tokens: " << (u64)(N / sec)
+                     << " items/sec, peak " << peak * SZ / 1024 << " KB in flight" << endl;
+        }
+}
+
+template<class Pool>
+void policy_run(const char *name, Pool *pool, size_t size)
+{
+        const int N = 1024 * 1024;
+        std::atomic<int> cnt(0);
+        auto t0 = bclock::now();
+        for (int i = 0; i < N; i++)
+                while (!pool->Execute([&cnt] () {cnt++;}))
+                        std::this_thread::yield();//bounded queue is full
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        double sec = elapsed_sec(t0);
+        delete pool;
+        cout << name << ": " << (u64)(N / sec) << " works/sec, sizeof " << size
+             << (cnt == N ? "" : " LOST WORKS") << endl;
+}
+
+void bench_policies()
+{//a million tiny works on 4 workers, ThreadPoolExecutor vs policy instantiations
+        cout << "============================ " << __func__ << " ==============" << endl;
+        typedef BasicThreadPoolExecutor<MutexQueue, ParkWait, DynamicSizing> Classic;
+        typedef BasicThreadPoolExecutor<MutexQueue, ParkWait, FixedSizing> FixedPark;
+        typedef BasicThreadPoolExecutor<LockFreeQueue, ParkWait, FixedSizing> FixedLfPark;
+        typedef BasicThreadPoolExecutor<LockFreeQueue, SpinWait, FixedSizing> FixedLfSpin;
+        policy_run("ThreadPoolExecutor fixed", ThreadPoolExecutor::NewFixedThreadPool(4),
+                   sizeof(ThreadPoolExecutor));
+        policy_run("<MutexQueue, ParkWait, DynamicSizing>",
+                   new Classic(DynamicSizing::Config(4, 4, 60)), sizeof(Classic));
+        policy_run("<MutexQueue, ParkWait, FixedSizing>", new FixedPark(4), sizeof(FixedPark));
+        policy_run("<LockFreeQueue, ParkWait, FixedSizing>", new FixedLfPark(4), sizeof(FixedLfPark));
+        policy_run("<LockFreeQueue, SpinWait, FixedSizing>", new FixedLfSpin(4), sizeof(FixedLfSpin));
+}
+
+void bench_producers()
+{//1 to 64 threads calling Execute() at once, one pool lock vs sharded queues
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int N = 512 * 1024;
+        const int producers[] = {1, 2, 4, 8, 16, 32, 64};
+        for (int sharded = 0; sharded <= 1; sharded++) {
+                for (auto np : producers) {
+                        auto pool = sharded ? ThreadPoolExecutor::NewShardedThreadPool(4)
+                                : ThreadPoolExecutor::NewFixedThreadPool(4);
+                        std::atomic<int> cnt(0);
+                        std::vector<std::thread> ths;
+                        auto t0 = bclock::now();
+                        for (int p = 0; p < np; p++)
+                                ths.emplace_back([&] () {
+                                                for (int i = 0; i < N / np; i++)
+                                                        pool->Execute([&cnt] () {cnt++;});
+                                        });
+                        for (auto &th : ths)
+                                th.join();
+                        double put = elapsed_sec(t0);
+                        pool->Shutdown(false);
+                        pool->AwaitTermination(0);
+                        double sec = elapsed_sec(t0);
+                        delete pool;
+                        int total = N / np * np;
+                        cout << (sharded ? "sharded " : "fixed   ") << np << " producers: "
+                             << (u64)(total / put) << " puts/sec, "
+                             << (u64)(total / sec) << " works/sec"
+                             << (cnt == total ? "" : " LOST WORKS") << endl;
+                }
+        }
+}
+
+void bench_admission()
+{//2x the pool capacity offered for 2 seconds, queueing delay without and with CoDel
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const float T = 2;
+        auto spin = [] () {
+                volatile u64 x = 0;
+                for (int i = 0; i < 200000; i++)
+                        x += i;
+        };
+        //capacity: works per second with the queue never empty
+        double cap;
+        {
+                const int N = 2000;
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+                auto t0 = bclock::now();
+                for (int i = 0; i < N; i++)
+                        pool->Execute(spin);
+                pool->Shutdown(false);
+                pool->AwaitTermination(0);
+                cap = N / elapsed_sec(t0);
+                delete pool;
+        }
+        cout << "capacity " << (u64)cap << " works/sec, offering " << (u64)(2 * cap) << endl;
+        //no admission control, then CoDel with a 5ms target over two intervals
+        const u32 intervals[] = {0, 100, 20};
+        for (auto ivl : intervals) {
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+                if (ivl) {
+                        ThreadPoolExecutor::AdmissionConfig cfg;
+                        cfg.targetUs = 5000;
+                        cfg.intervalMs = ivl;
+                        pool->SetAdmissionControl(cfg);
+                }
+                const int total = (int)(2 * cap * T);
+                std::vector<double> delay(total);
+                std::atomic<int> done(0);
+                int refused = 0;
+                auto t0 = bclock::now();
+                //put the works of every millisecond at its start
+                for (int i = 0, ms = 0; i < total; ms++) {
+                        std::this_thread::sleep_until(t0 + std::chrono::milliseconds(ms));
+                        int until = (int)(2 * cap * (ms + 1) / 1000);
+                        for (; i < total && i < until; i++) {
+                                auto put = bclock::now();
+                                if (!pool->Execute([&, put] () {
+                                                        delay[done++] = elapsed_sec(put);
+                                                        spin();
+                                                }))
+                                        refused++;
+                        }
+                }
+                pool->Shutdown(false);
+                pool->AwaitTermination(0);
+                auto st = pool->GetStats();
+                delete pool;
+                int n = done;
+                std::sort(delay.begin(), delay.begin() + n);
+                cout << (ivl ? "codel, interval " + to_string(ivl) + "ms" : string("no admission"))
+                     << ": " << n << " run, " << refused
+                     << " refused, queueing delay p50 " << delay[n / 2] * 1000
+                     << "ms p99 " << delay[n * 99 / 100] * 1000
+                     << "ms max " << delay[n - 1] * 1000 << "ms, overloads "
+                     << st.admission.overloads << endl;
+        }
+}
+
+void bench_parallel()
+{//ParallelSort vs std::sort and ParallelInclusiveScan vs std::partial_sum, 1M to 1B elements
+        cout << "============================ " << __func__ << " ==============" << endl;
+        u32 hw = std::thread::hardware_concurrency();
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(hw ? hw : 1);
+        const size_t sizes[] = {1000000, 10000000, 100000000, 1000000000};
+        u64 mem = (u64)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+        for (auto n : sizes) {
+                //the sort needs data, a copy and scratch of u32, the scan in and out of u64
+                if ((u64)n * 16 > mem / 2) {
+                        cout << n << " elements: skipped, not enough memory" << endl;
+                        continue;
+                }
+                std::vector<u32> v(n);
+                u32 seed = 1;
+                for (auto &x : v)
+                        x = seed = seed * 1103515245 + 12345;
+                {
+                        std::vector<u32> w(v);
+                        auto t0 = bclock::now();
+                        std::sort(w.begin(), w.end());
+                        double ss = elapsed_sec(t0);
+                        w = v;
+                        t0 = bclock::now();
+                        ParallelSort(pool, w.begin(), w.end());
+                        double ps = elapsed_sec(t0);
+                        cout << n << " elements: std::sort " << ss << "s, ParallelSort " << ps
+                             << "s" << (std::is_sorted(w.begin(), w.end()) ? "" : " NOT SORTED") << endl;
+                }
+                std::vector<u64> in(v.begin(), v.end());
+                std::vector<u32>().swap(v);
+                std::vector<u64> out(n);
+                auto t0 = bclock::now();
+                std::partial_sum(in.begin(), in.end(), out.begin());
+                double ss = elapsed_sec(t0);
+                u64 last = out[n - 1];
+                t0 = bclock::now();
+                ParallelInclusiveScan(pool, in.begin(), in.end(), out.begin());
+                double ps = elapsed_sec(t0);
+                cout << n << " elements: std::partial_sum " << ss << "s, ParallelInclusiveScan "
+                     << ps << "s" << (out[n - 1] == last ? "" : " WRONG") << endl;
+        }
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+}
+
+void bench_durable()
+{//a million 32 byte descriptors through the durable queue vs plain Execute()
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int N = 1024 * 1024;
+        const char *path = "/tmp/bench_durable.log";
+        struct Desc {
+                u64 id;
+                char pad[24];
+        };
+        std::atomic<u64> sum(0);
+        {
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+                auto t0 = bclock::now();
+                for (int i = 0; i < N; i++) {
+                        Desc d = {(u64)i, {0}};
+                        pool->Execute([&sum, d] () {sum += d.id;});
+                }
+                pool->Shutdown(false);
+                pool->AwaitTermination(0);
+                cout << "in memory: " << (u64)(N / elapsed_sec(t0)) << " works/sec" << endl;
+                delete pool;
+        }
+        const u32 periods[] = {100, 1000, 10000};
+        for (auto us : periods) {
+                unlink(path);
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+                auto q = new DurableQueue(pool, path, 256 << 20, us);
+                q->Register(1, [&sum] (const char *data, u32 len) {
+                                Desc d;
+                                memcpy(&d, data, sizeof(d));
+                                sum += d.id;
+                        });
+                q->Start();
+                auto t0 = bclock::now();
+                for (int i = 0; i < N; i++) {
+                        Desc d = {(u64)i, {0}};
+                        while (!q->Put(1, &d, sizeof(d)))
+                                std::this_thread::yield();//log full
+                }
+                q->Flush();
+                delete q;
+                double sec = elapsed_sec(t0);
+                pool->Shutdown(false);
+                pool->AwaitTermination(0);
+                delete pool;
+                cout << "durable, commit every " << us << "us: " << (u64)(N / sec) << " works/sec" << endl;
+        }
+        unlink(path);
+}
+
+void bench_workload()
+{//record bursty traffic once, then replay it against a few pool configurations
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const char *path = "/tmp/bench_workload.trace";
+        auto spin = [] (u32 us) {
+                auto end = bclock::now() + std::chrono::microseconds(us);
+                while (bclock::now() < end)
+                        ;
+        };
+        {
+                auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+                pool->EnableWorkloadRecording();
+                std::vector<std::thread> subs;
+                //4 submitters, each a burst of 100 short works every 20ms
+                //and a long one in between
+                for (u32 t = 0; t < 4; t++)
+                        subs.emplace_back([pool, t, &spin] () {
+                                        for (int r = 0; r < 25; r++) {
+                                                for (int i = 0; i < 100; i++)
+                                                        pool->Execute(t, [&spin] () {spin(20);});
+                                                pool->Execute(t, [&spin] () {spin(2000);});
+                                                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                                        }
+                                });
+                for (auto &t : subs)
+                        t.join();
+                pool->Shutdown(false);
+                pool->AwaitTermination(0);
+                pool->FlushWorkload(path);
+                delete pool;
+        }
+        std::vector<WorkloadRecord> recs;
+        if (!ReadWorkload(path, recs)) {
+                cout << "no trace" << endl;
+                return;
+        }
+        FILE *f = fopen(path, "rb");
+        fseek(f, 0, SEEK_END);
+        cout << recs.size() << " works recorded, " << ftell(f) << " bytes" << endl;
+        fclose(f);
+        struct {
+                const char *name;
+                ThreadPoolExecutor *(*make)();
+        } configs[] = {
+                {"fixed 1", [] () {return ThreadPoolExecutor::NewFixedThreadPool(1);}},
+                {"fixed 4", [] () {return ThreadPoolExecutor::NewFixedThreadPool(4);}},
+                {"cached", [] () {return ThreadPoolExecutor::NewCachedThreadPool();}},
+                {"sharded 4", [] () {return ThreadPoolExecutor::NewShardedThreadPool(4);}},
+        };
+        for (auto &c : configs) {
+                auto pool = c.make();
+                auto rp = ReplayWorkload(pool, recs);
+                pool->Shutdown(false);
+                pool->AwaitTermination(0);
+                delete pool;
+                cout << c.name << ": " << (u64)rp.throughput << " works/sec, delay us p50 "
+                     << rp.waitP50 << " p99 " << rp.waitP99 << " max " << rp.waitMax
+                     << ", threads peak " << rp.peakThreads << " avg " << rp.avgThreads << endl;
+        }
+        unlink(path);
+}
+
+void bench_sync()
+{//fork/join rounds of 4 tiny works, joined with a Latch vs a mutex, counter and condition variable
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const int R = 20000;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        auto t0 = bclock::now();
+        for (int r = 0; r < R; r++) {
+                std::mutex lock;
+                std::condition_variable cv;
+                int left = 4;
+                for (int i = 0; i < 4; i++)
+                        pool->Execute([&] () {
+                                        std::lock_guard<std::mutex> lk(lock);
+                                        if (--left == 0)
+                                                cv.notify_all();
+                                });
+                std::unique_lock<std::mutex> lk(lock);
+                cv.wait(lk, [&left] {return left == 0;});
+        }
+        cout << "mutex+cv: " << (u64)(R / elapsed_sec(t0)) << " rounds/sec" << endl;
+        const u32 spins[] = {0, 20, 200};
+        for (auto us : spins) {
+                t0 = bclock::now();
+                for (int r = 0; r < R; r++) {
+                        Latch l(4);
+                        l.SetSpin(us);
+                        for (int i = 0; i < 4; i++)
+                                pool->Execute([&l] () {l.CountDown();});
+                        l.Wait();
+                }
+                cout << "latch, spin " << us << "us: " << (u64)(R / elapsed_sec(t0))
+                     << " rounds/sec" << endl;
+        }
+        //nested: the joins run on workers, which help instead of blocking
+        t0 = bclock::now();
+        Latch outer(R / 100);
+        for (int r = 0; r < R / 100; r++)
+                pool->Execute([&] () {
+                                Latch l(100);
+                                for (int i = 0; i < 100; i++)
+                                        pool->Execute([&l] () {l.CountDown();});
+                                l.Wait();
+                                outer.CountDown();
+                        });
+        outer.Wait();
+        cout << "nested latch in workers: " << (u64)(R / elapsed_sec(t0)) << " works/sec" << endl;
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+}
+
+/*
+  run every benchmark, or only those whose name contains argv[1]
+ */
+int bmain(int argc, char **argv)
+{
+        struct {
+                const char *name;
+                void (*fn)();
+        } benches[] = {
+#ifdef __linux__
+                {"reactor_echo", bench_reactor_echo},
+#endif
+                {"arena_vector", bench_arena_vector},
+                {"million_tasks", bench_million_tasks},
+                {"lifo_wakeup", bench_lifo_wakeup},
+                {"spin_latency", bench_spin_latency},
+                {"pipeline", bench_pipeline},
+                {"policies", bench_policies},
+                {"producers", bench_producers},
+                {"admission", bench_admission},
+                {"parallel", bench_parallel},
+                {"durable", bench_durable},
+                {"workload", bench_workload},
+                {"sync", bench_sync},
+                {nullptr, nullptr}
+        };
+        for (int i = 0; benches[i].name; i++)
+                if (argc < 2 || string(benches[i].name).find(argv[1]) != string::npos)
+                        benches[i].fn();
+        return 0;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include "ThreadPoolExecutor.h"
+
+/*
+  Hands back the results of submitted works in the order they finish, like
+  Java's ExecutorCompletionService, so a gather loop is never stuck behind
+  the slowest work. Finished works push their future onto a lock free list
+  (one exchange per result), the consumer pops without a lock and only
+  touches a mutex when it has to sleep.
+  Take(), Poll() and TakeBatch() must be called from one thread at a time.
+  The destructor waits for the works not yet taken. A work the executor
+  accepts but drops unrun still comes back once the executor destroys it,
+  its future throws std::future_error broken_promise. A ThreadPoolExecutor
+  does so when its last worker leaves after Shutdown(true), an onReject that
+  lets the work go when it returns.
+ */
+template<class T>
+class CompletionService {
+public:
+        //ex must outlive the service
+        explicit CompletionService(Executor *aex)
+                : ex(aex), head(&stub), tail(&stub), ready(0), waiting(false),
+                  signaled(false), pending(0), pushing(0) {
+                assert(ex != nullptr);
+                stub.next = nullptr;
+        }
+        ~CompletionService() {
+                while (pending > 0)
+                        Take();
+                //the last producers may still be leaving Push()
+                while (pushing > 0)
+                        std::this_thread::yield();
+        }
+        /*
+          return false when the executor refused the work
+         */
+        template<class F>
+        bool Submit(F fn) {
+                auto job = std::make_shared<Job>(this, std::move(fn));
+                Node *n = job->n;
+                pending++;
+                if (!ex->Execute([job] () {
+                                        job->task();
+                                        Node *done = job->n;
+                                        job->n = nullptr;
+                                        job->cs->Push(done);
+                                })) {
+                        job->n = nullptr;
+                        pending--;
+                        delete n;
+                        return false;
+                }
+                return true;
+        }
+        //wait for the next finished work, get() on it does not block
+        std::future<T> Take() {
+                std::future<T> f;
+                Poll(f, 0);
+                return f;
+        }
+        /*
+          wait up to timeoutMs(0 forever) for the next finished work.
+          return false on timeout
+         */
+        bool Poll(std::future<T> &f, u32 timeoutMs) {
+                Node *n = Pop(timeoutMs);
+                if (n == nullptr)
+                        return false;
+                f = std::move(n->fut);
+                delete n;
+                return true;
+        }
+        /*
+          wait for at least one finished work, then take what is there up to
+          max. return the number taken, 0 right away when max is 0
+         */
+        size_t TakeBatch(std::vector<std::future<T> > &out, size_t max) {
+                size_t got = 0;
+                if (max == 0)
+                        return 0;
+                for (Node *n = Pop(0); n; n = got < max ? Pop(NOWAIT) : nullptr) {
+                        out.push_back(std::move(n->fut));
+                        delete n;
+                        got++;
+                }
+                return got;
+        }
+        //submitted and not yet taken
+        size_t GetPending() {
+                return pending;
+        }
+private:
+        static const u32 NOWAIT = 0xffffffff;
+        struct Node {
+                std::atomic<Node *> next;
+                std::future<T> fut;
+        };
+        //a submitted work, comes back even when the executor drops it unrun
+        struct Job {
+                template<class F>
+                Job(CompletionService *acs, F &&fn)
+                        : cs(acs), task(std::forward<F>(fn)), n(new Node()) {
+                        n->fut = task.get_future();
+                }
+                ~Job() {
+                        if (n == nullptr)
+                                return;
+                        //the future is ready before anyone can take it
+                        task = std::packaged_task<T()>();
+                        cs->Push(n);
+                }
+                CompletionService *cs;
+                std::packaged_task<T()> task;
+                Node *n;//nullptr once pushed or refused
+        };
+        Executor *ex;
+        //intrusive MPSC list: producers swap head, the consumer walks tail
+        Node stub;
+        std::atomic<Node *> head;
+        Node *tail;
+        std::atomic<u32> ready;//pushed and not yet popped
+        std::atomic<bool> waiting;//consumer is about to sleep
+        std::mutex lock;//only for sleeping
+        std::condition_variable cv;
+        bool signaled;
+        std::atomic<size_t> pending;
+        std::atomic<u32> pushing;//producers inside Push()
+
+        void Push(Node *n) {
+                pushing++;
+                Link(n);
+                ready++;
+                if (waiting.exchange(false)) {
+                        std::lock_guard<std::mutex> lk(lock);
+                        signaled = true;
+                        cv.notify_one();
+                }
+                pushing--;
+        }
+        void Link(Node *n) {
+                n->next.store(nullptr, std::memory_order_relaxed);
+                Node *prev = head.exchange(n, std::memory_order_acq_rel);
+                prev->next.store(n, std::memory_order_release);
+        }
+        //nullptr when empty or a producer is half way through Link()
+        Node *TryPop() {
+                Node *t = tail;
+                Node *next = t->next.load(std::memory_order_acquire);
+                if (t == &stub) {
+                        if (next == nullptr)
+                                return nullptr;
+                        tail = next;
+                        t = next;
+                        next = next->next.load(std::memory_order_acquire);
+                }
+                if (next) {
+                        tail = next;
+                        return t;
+                }
+                if (t != head.load(std::memory_order_acquire))
+                        return nullptr;
+                //t is the last one, put the stub behind it to take it out
+                Link(&stub);
+                next = t->next.load(std::memory_order_acquire);
+                if (next) {
+                        tail = next;
+                        return t;
+                }
+                return nullptr;
+        }
+        Node *Pop(u32 timeoutMs) {
+                auto until = std::chrono::steady_clock::now()
+                        + std::chrono::milliseconds(timeoutMs == NOWAIT ? 0 : timeoutMs);
+                while (1) {
+                        if (ready.load() > 0) {
+                                Node *n = TryPop();
+                                if (n) {
+                                        ready--;
+                                        pending--;
+                                        return n;
+                                }
+                                //a producer is between two stores
+                                std::this_thread::yield();
+                                continue;
+                        }
+                        if (timeoutMs == NOWAIT)
+                                return nullptr;
+                        waiting = true;
+                        if (ready.load() > 0) {
+                                if (waiting.exchange(false))
+                                        continue;
+                                //a producer took the flag, its signal is coming
+                        }
+                        std::unique_lock<std::mutex> lk(lock);
+                        auto sig = [this] {return signaled;};
+                        if (timeoutMs == 0) {
+                                cv.wait(lk, sig);
+                        } else if (!cv.wait_until(lk, until, sig)) {
+                                if (waiting.exchange(false))
+                                        return nullptr;
+                                //lost the race with a producer, take its signal
+                                cv.wait(lk, sig);
+                        }
+                        signaled = false;
+                }
+        }
+};
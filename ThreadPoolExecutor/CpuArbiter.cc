@@ -0,0 +1,139 @@
+#include "CpuArbiter.h"
+#include <cassert>
+
+CpuArbiter::CpuArbiter(u32 abudget)
+        : budget(abudget),
+          held(0)
+{
+        if (budget == 0)
+                budget = std::thread::hardware_concurrency();
+        if (budget == 0)
+                budget = 1;
+}
+
+CpuArbiter *CpuArbiter::Global()
+{
+        //never destroyed, pools may still give permits back at exit
+        static CpuArbiter *arb = new CpuArbiter();
+        return arb;
+}
+
+u32 CpuArbiter::GetBudget()
+{
+        std::lock_guard<std::mutex> lk(lock);
+        return budget;
+}
+
+void CpuArbiter::SetBudget(u32 abudget)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        budget = abudget ? abudget : 1;
+        Dispatch();
+}
+
+std::vector<CpuArbiter::PoolStats> CpuArbiter::GetStats()
+{
+        std::lock_guard<std::mutex> lk(lock);
+        std::vector<PoolStats> st;
+        for (auto &kv : pools) {
+                const Entry &e = kv.second;
+                PoolStats ps = {kv.first, e.weight, e.held, e.waiting, e.granted};
+                st.push_back(ps);
+        }
+        return st;
+}
+
+void CpuArbiter::Register(const ThreadPoolExecutor *pool, u32 weight)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        Entry &e = pools[pool];
+        e.weight = weight ? weight : 1;
+}
+
+void CpuArbiter::Unregister(const ThreadPoolExecutor *pool)
+{
+        std::unique_lock<std::mutex> lk(lock);
+        auto it = pools.find(pool);
+        if (it == pools.end())
+                return;
+        Entry &e = it->second;
+        e.cancel = true;
+        e.cv.notify_all();
+        e.cv.wait(lk, [&e] {return e.waiting == 0;});
+        //permits still held are lost with the entry, give them back
+        held -= e.held;
+        pools.erase(it);
+        Dispatch();
+}
+
+bool CpuArbiter::Acquire(const ThreadPoolExecutor *pool)
+{
+        std::unique_lock<std::mutex> lk(lock);
+        auto it = pools.find(pool);
+        if (it == pools.end())
+                return false;
+        Entry &e = it->second;
+        if (e.cancel)
+                return false;
+        e.waiting++;
+        Dispatch();
+        e.cv.wait(lk, [&e] {return e.grants > 0 || e.cancel;});
+        e.waiting--;
+        //Unregister() waits for the last one
+        if (e.cancel && e.waiting == 0)
+                e.cv.notify_all();
+        if (e.grants == 0)
+                return false;
+        e.grants--;
+        return true;
+}
+
+void CpuArbiter::Release(const ThreadPoolExecutor *pool)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = pools.find(pool);
+        if (it == pools.end())
+                return;
+        assert(it->second.held > 0 && held > 0);
+        it->second.held--;
+        held--;
+        Dispatch();
+}
+
+void CpuArbiter::Cancel(const ThreadPoolExecutor *pool)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = pools.find(pool);
+        if (it == pools.end())
+                return;
+        Entry &e = it->second;
+        e.cancel = true;
+        //grants not picked up yet go back to the others
+        e.held -= e.grants;
+        held -= e.grants;
+        e.grants = 0;
+        e.cv.notify_all();
+        Dispatch();
+}
+
+void CpuArbiter::Dispatch()
+{//this is already guarded by a lock
+        while (held < budget) {
+                //weighted fair: fewest permits per weight among the waiting
+                Entry *best = nullptr;
+                for (auto &kv : pools) {
+                        Entry &e = kv.second;
+                        if (e.cancel || e.waiting <= e.grants)
+                                continue;
+                        if (!best || (u64)e.held * best->weight < (u64)best->held * e.weight)
+                                best = &e;
+                }
+                if (!best)
+                        return;
+                best->held++;
+                best->grants++;
+                best->granted++;
+                held++;
+                best->cv.notify_one();
+        }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include "ThreadPoolExecutor.h"
+
+/*
+  Shares a budget of cores among the pools of a process. A worker of a pool
+  attached with SetCpuArbiter() holds a permit while it runs a batch of works,
+  so no more than budget workers run at once over all those pools, however
+  each pool sizes itself. A free permit goes to the waiting pool holding the
+  fewest permits for its weight, pools with nothing to run do not count, so
+  their share is lent to the busy ones until they have works again.
+  A worker inside ManagedBlock() gives its permit back, and a pool stops
+  asking for permits once it is shut down, so draining never waits on other
+  pools. The arbiter must outlive every pool attached to it.
+ */
+class CpuArbiter {
+public:
+        //budget 0 means std::thread::hardware_concurrency()
+        explicit CpuArbiter(u32 budget = 0);
+        //the process wide arbiter
+        static CpuArbiter *Global();
+        u32 GetBudget();
+        //takes effect as permits are given back
+        void SetBudget(u32 budget);
+        struct PoolStats {
+                const ThreadPoolExecutor *pool;
+                u32 weight;
+                u32 held;//permits held now
+                u32 waiting;//workers waiting for a permit
+                u64 granted;//permits granted so far
+        };
+        std::vector<PoolStats> GetStats();
+private:
+        friend class ThreadPoolExecutor;
+        struct Entry {
+                Entry() : weight(1), held(0), waiting(0), grants(0), granted(0),
+                          cancel(false) {}
+                u32 weight;
+                u32 held;
+                u32 waiting;
+                u32 grants;//granted but not yet picked up by a waiter
+                u64 granted;
+                bool cancel;
+                std::condition_variable cv;
+        };
+        std::mutex lock;
+        u32 budget;
+        u32 held;
+        std::map<const ThreadPoolExecutor *, Entry> pools;
+        void Register(const ThreadPoolExecutor *pool, u32 weight);
+        void Unregister(const ThreadPoolExecutor *pool);
+        //wait for a permit, return false without one once pool was cancelled
+        bool Acquire(const ThreadPoolExecutor *pool);
+        void Release(const ThreadPoolExecutor *pool);
+        //pool no longer waits for permits
+        void Cancel(const ThreadPoolExecutor *pool);
+        //hand free permits to waiters, this is already guarded by a lock
+        void Dispatch();
+};
@@ -0,0 +1,469 @@
+#include "DurableQueue.h"
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const u64 MAGIC = 0x31304c5145505444ULL;//"DTPEQL01"
+
+static inline u64 align8(u64 n)
+{
+        return (n + 7) & ~7ULL;
+}
+
+//the work of an entry, acknowledges it when run, dispatches it again when
+//the pool accepted the work and dropped it unrun
+struct DurableQueue::Ticket {
+        Ticket(DurableQueue *aq, const Slot &asl)
+                : q(aq), sl(asl), acked(false), refused(false) {}
+        ~Ticket() {
+                q->Done(sl, acked, !acked && !refused);
+        }
+        DurableQueue *q;
+        Slot sl;
+        bool acked;
+        bool refused;//never got into the pool, the dispatcher takes over
+};
+
+DurableQueue::DurableQueue(ThreadPoolExecutor *apool, const std::string &apath,
+                           u64 asize, u32 commitUs)
+        : pool(apool),
+          path(apath),
+          size(asize),
+          cus(commitUs ? commitUs : 1),
+          fd(-1),
+          map(nullptr),
+          hdr(nullptr),
+          started(false),
+          stop(false),
+          nacks(0),
+          tail(HDR),
+          nseq(1),
+          sofs(HDR),
+          wraps(0),
+          swraps(0),
+          durable(1),
+          adirty(false),
+          failed(0),
+          inflight(0),
+          flushing(false),
+          cidle(false)
+{
+        assert(pool != nullptr);
+        memset(&st, 0, sizeof(st));
+}
+
+DurableQueue::~DurableQueue()
+{
+        {
+                std::unique_lock<std::mutex> lk(lock);
+                cv.wait(lk, [this] {return inflight == 0;});
+                stop = true;
+                cv.notify_all();
+        }
+        if (committer.joinable())
+                committer.join();
+        if (map)
+                munmap(map, size);
+        if (fd >= 0)
+                close(fd);
+}
+
+bool DurableQueue::Register(u32 type, const Handler &handler)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (started)
+                return false;
+        handlers[type] = handler;
+        return true;
+}
+
+bool DurableQueue::Start()
+{
+        std::vector<Slot> replay;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                if (started || fd >= 0)
+                        return false;
+                fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+                if (fd < 0)
+                        return false;
+                struct stat sb;
+                if (fstat(fd, &sb) != 0)
+                        return false;
+                if (sb.st_size == 0) {
+                        if (size < HDR * 2 || ftruncate(fd, size) != 0)
+                                return false;
+                } else {
+                        size = sb.st_size;
+                }
+                void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                        return false;
+                map = (char *)p;
+                hdr = (FileHeader *)map;
+                if (hdr->magic == 0) {
+                        hdr->size = size;
+                        hdr->cursor = HDR;
+                        hdr->cseq = 1;
+                        hdr->magic = MAGIC;
+                } else if (hdr->magic != MAGIC || hdr->size != size
+                           || hdr->cursor < HDR || hdr->cursor >= size) {
+                        return false;
+                }
+                //walk the chain of consecutive seqs from the cursor. A torn
+                //cursor update leaves the new cursor with the old seq, so
+                //an entry newer than cseq is accepted as the start
+                u64 pos = hdr->cursor, seq = hdr->cseq;
+                const Entry *e = (const Entry *)(map + pos);
+                if (pos + sizeof(Entry) <= size && e->seq > seq
+                    && pos + sizeof(Entry) + e->len <= size
+                    && e->sum == Checksum(e, (const char *)(e + 1)))
+                        seq = e->seq;
+                for (u64 walked = 0; walked < size; ) {
+                        if (pos + sizeof(Entry) > size) {
+                                walked += size - pos;
+                                pos = HDR;
+                                continue;
+                        }
+                        e = (const Entry *)(map + pos);
+                        if (e->seq != seq || pos + sizeof(Entry) + e->len > size
+                            || e->sum != Checksum(e, (const char *)(e + 1)))
+                                break;
+                        if (e->flags & WRAP) {
+                                walked += size - pos;
+                                pos = HDR;
+                                continue;
+                        }
+                        Slot sl = {seq, pos};
+                        if (!(e->flags & CANCELLED)) {
+                                replay.push_back(sl);
+                                slots.push_back(sl);
+                        }
+                        u64 need = align8(sizeof(Entry) + e->len);
+                        pos += need;
+                        walked += need;
+                        seq++;
+                }
+                nacks = (size - HDR) / sizeof(Entry) + 1;
+                acks.reset(new std::atomic<bool>[nacks]);
+                for (u64 i = 0; i < nacks; i++)
+                        acks[i] = false;
+                tail = pos;
+                nseq = seq;
+                sofs = tail;
+                durable = nseq;
+                SetCursor();
+                st.replayed = replay.size();
+                inflight += replay.size();
+                started = true;
+                committer = std::thread(&DurableQueue::CommitLoop, this);
+        }
+        for (auto &sl : replay) {
+                if (!Dispatch(sl)) {
+                        std::lock_guard<std::mutex> lk(lock);
+                        redo.push_back(sl);
+                        Kick();
+                }
+        }
+        return true;
+}
+
+bool DurableQueue::Put(u32 type, const void *data, u32 len)
+{
+        u64 need = align8(sizeof(Entry) + len);
+        Slot sl;
+        Entry *e;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                if (!started || stop || handlers.find(type) == handlers.end())
+                        return false;
+                Advance();
+                if (need >= size - HDR || !Reserve(need)) {
+                        st.full++;
+                        return false;
+                }
+                sl.seq = nseq++;
+                sl.off = tail;
+                e = (Entry *)(map + tail);
+                e->len = len;
+                e->type = type;
+                e->seq = sl.seq;
+                e->flags = 0;
+                memcpy(e + 1, data, len);
+                e->sum = Checksum(e, (const char *)(e + 1));
+                slots.push_back(sl);
+                tail += need;
+                st.appended++;
+                inflight++;
+                Kick();
+        }
+        if (Dispatch(sl))
+                return true;
+        //the pool refused it, the entry must never run, not even on replay.
+        //Nothing can reclaim it before it is acknowledged, and the sum does
+        //not cover CANCELLED so a crash can not tear the entry
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                e->flags |= CANCELLED;
+                acks[sl.seq % nacks].store(true, std::memory_order_release);
+                Advance();
+                st.refused++;
+        }
+        //the commit may already be past it
+        SyncRange((char *)e - map, (char *)(e + 1) - map);
+        return false;
+}
+
+void DurableQueue::Flush()
+{
+        std::unique_lock<std::mutex> lk(lock);
+        if (!started)
+                return;
+        u64 want = nseq;
+        flushing = true;
+        cv.notify_all();
+        cv.wait(lk, [this, want] {return durable >= want;});
+}
+
+DurableQueue::Stats DurableQueue::GetStats()
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (started)
+                Advance();
+        Stats s = st;
+        s.pending = slots.size();
+        s.failed = failed;
+        return s;
+}
+
+void DurableQueue::CommitLoop()
+{
+        std::unique_lock<std::mutex> lk(lock);
+        while (1) {
+                cidle = true;
+                cv.wait(lk, [this] {
+                                return stop || durable != nseq || adirty || !redo.empty();
+                        });
+                cidle = false;
+                Redispatch(lk);
+                Advance();
+                //let the puts of the next commitUs join this commit
+                if (!stop && !flushing)
+                        cv.wait_for(lk, std::chrono::microseconds(cus),
+                                    [this] {return stop || flushing;});
+                Advance();
+                if (durable != nseq || adirty) {
+                        u64 from = sofs, to = tail, want = nseq, w = wraps;
+                        adirty = false;
+                        lk.unlock();
+                        //entries first, then the cursor that may point at them
+                        if (w != swraps)
+                                SyncRange(HDR, size);
+                        else
+                                SyncRange(from, to);
+                        SyncRange(0, sizeof(FileHeader));
+                        lk.lock();
+                        sofs = to;
+                        swraps = w;
+                        durable = want;
+                        st.commits++;
+                }
+                if (durable == nseq)
+                        flushing = false;
+                cv.notify_all();
+                if (stop && durable == nseq && !adirty)
+                        return;
+        }
+}
+
+void DurableQueue::SyncRange(u64 from, u64 to)
+{
+        static const u64 page = sysconf(_SC_PAGESIZE);
+        if (to <= from)
+                return;
+        u64 a = from & ~(page - 1);
+        msync(map + a, to - a, MS_SYNC);
+}
+
+u32 DurableQueue::Checksum(const Entry *e, const char *data)
+{//FNV-1a
+        u32 h = 2166136261u;
+        auto mix = [&h] (const void *p, size_t n) {
+                const unsigned char *c = (const unsigned char *)p;
+                for (size_t i = 0; i < n; i++)
+                        h = (h ^ c[i]) * 16777619u;
+        };
+        mix(&e->len, sizeof(e->len));
+        mix(&e->type, sizeof(e->type));
+        mix(&e->seq, sizeof(e->seq));
+        u32 f = e->flags & ~CANCELLED;
+        mix(&f, sizeof(f));
+        if (!(e->flags & WRAP))
+                mix(data, e->len);
+        return h;
+}
+
+bool DurableQueue::Reserve(u64 need)
+{//this is already guarded by a lock
+        if (slots.empty()) {
+                //nothing to keep, start over at the front
+                if (tail != HDR)
+                        Wrap();
+                SetCursor();
+                return true;
+        }
+        u64 cur = slots.front().off;
+        if (tail >= cur) {
+                if (tail + need <= size)
+                        return true;
+                if (HDR + need >= cur)
+                        return false;
+                Wrap();
+                return true;
+        }
+        //never catch up with the cursor, tail == cursor means empty
+        return tail + need < cur;
+}
+
+void DurableQueue::Wrap()
+{//this is already guarded by a lock
+        //a reader of an old cursor follows the marker to the new entries
+        if (tail + sizeof(Entry) <= size) {
+                Entry *m = (Entry *)(map + tail);
+                m->len = 0;
+                m->type = 0;
+                m->seq = nseq;
+                m->flags = WRAP;
+                m->sum = Checksum(m, nullptr);
+        }
+        tail = HDR;
+        wraps++;
+}
+
+void DurableQueue::SetCursor()
+{//this is already guarded by a lock
+        u64 cur = slots.empty() ? tail : slots.front().off;
+        u64 seq = slots.empty() ? nseq : slots.front().seq;
+        if (hdr->cursor == cur && hdr->cseq == seq)
+                return;
+        hdr->cursor = cur;
+        std::atomic_thread_fence(std::memory_order_release);
+        hdr->cseq = seq;
+        adirty = true;
+        Kick();
+}
+
+void DurableQueue::Kick()
+{//this is already guarded by a lock
+        if (cidle) {
+                cidle = false;
+                cv.notify_all();
+        }
+}
+
+bool DurableQueue::Dispatch(const Slot &sl)
+{
+        const Entry *e = (const Entry *)(map + sl.off);
+        const char *data = (const char *)(e + 1);
+        u32 len = e->len;
+        auto it = handlers.find(e->type);
+        auto tk = std::make_shared<Ticket>(this, sl);
+        if (it == handlers.end()) {
+                //replayed entry nobody handles any more
+                tk->acked = true;
+                return true;
+        }
+        const Handler *h = &it->second;
+        std::atomic<u64> *nf = &failed;
+        //we hold tk until the pool decided, a work it drops unrun later
+        //leaves the ticket unacked and the entry is dispatched again
+        bool ok = pool->Execute([tk, h, data, len, nf] () {
+                        try {
+                                (*h)(data, len);
+                        } catch (...) {
+                                //running it again would most likely throw
+                                //again, the pool gets the exception
+                                (*nf)++;
+                                tk->acked = true;
+                                throw;
+                        }
+                        tk->acked = true;
+                });
+        if (!ok)
+                tk->refused = true;
+        return ok;
+}
+
+void DurableQueue::Redispatch(std::unique_lock<std::mutex> &lk)
+{//this is already guarded by a lock
+        if (redo.empty() || stop)
+                return;
+        std::deque<Slot> todo;
+        todo.swap(redo);
+        inflight += todo.size();
+        lk.unlock();
+        std::deque<Slot> again;
+        for (auto &sl : todo) {
+                if (!Dispatch(sl))
+                        again.push_back(sl);
+        }
+        lk.lock();
+        redo.insert(redo.begin(), again.begin(), again.end());
+}
+
+void DurableQueue::Advance()
+{//this is already guarded by a lock
+        u64 n = 0;
+        while (!slots.empty()) {
+                std::atomic<bool> &a = acks[slots.front().seq % nacks];
+                if (!a.load(std::memory_order_acquire))
+                        break;
+                a.store(false, std::memory_order_relaxed);
+                slots.pop_front();
+                n++;
+        }
+        if (n) {
+                st.acked += n;
+                SetCursor();
+        }
+}
+
+void DurableQueue::Done(const Slot &sl, bool acked, bool dropped)
+{
+        if (acked) {
+                acks[sl.seq % nacks].store(true, std::memory_order_release);
+                //whoever holds the lock now, or the next put or commit,
+                //moves the cursor
+                if (lock.try_lock()) {
+                        Advance();
+                        lock.unlock();
+                }
+        } else if (dropped) {
+                //it would hold the cursor until a restart, give it another
+                //go like a refused replay. The pool never drops a work
+                //under its own lock, so we can take ours
+                std::lock_guard<std::mutex> lk(lock);
+                redo.push_back(sl);
+                st.dropped++;
+                Kick();
+        }
+        //the last one leaves under the lock, the destructor frees us as
+        //soon as it sees 0
+        u64 v = inflight.load();
+        while (1) {
+                if (v > 1) {
+                        if (inflight.compare_exchange_weak(v, v - 1))
+                                return;
+                        continue;
+                }
+                std::lock_guard<std::mutex> lk(lock);
+                if (inflight.compare_exchange_strong(v, 0)) {
+                        cv.notify_all();
+                        return;
+                }
+        }
+}
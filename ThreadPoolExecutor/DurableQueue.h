@@ -0,0 +1,158 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <deque>
+#include <map>
+#include <string>
+#include "ThreadPoolExecutor.h"
+
+/*
+  A persistent queue of task descriptors in front of a ThreadPoolExecutor,
+  for jobs that must survive a shutdown or a crash. Every Put() appends the
+  descriptor(a type and a few bytes of payload) to a memory mapped log file
+  and puts a work into the pool that calls the handler registered for the
+  type. The entry is acknowledged when the handler returns, the consumer
+  cursor in the file header moves past every acknowledged entry at the
+  front. A committer thread msync()s the new entries and the cursor every
+  commitUs, so many puts share one disk flush.
+  Start() on an existing log first dispatches again every entry behind the
+  cursor: works that never ran, were dropped by Shutdown(true) or were
+  running at a crash. Handlers must therefore cope with running twice.
+  A handler that throws still acknowledges its entry, it is counted in
+  Stats.failed and never run again. A put the pool refuses is cancelled in
+  the log and Put() returns false, a replayed entry the pool refuses is
+  dispatched again every commitUs. So is an entry whose work the pool
+  accepted and then dropped unrun(Shutdown(true), an onReject that lets it
+  go), see Stats.dropped. Until it runs it holds the cursor, a pool that
+  keeps dropping works fills the log.
+  The log is a ring of fixed size, Put() returns false when unacknowledged
+  entries fill it. Entries are only written by the process, the page cache
+  keeps them over a crash of the process, msync() over a crash of the OS.
+ */
+class DurableQueue {
+public:
+        //data stays valid until the handler returns
+        typedef std::function<void(const char *data, u32 len)> Handler;
+        struct Stats {
+                u64 appended;
+                u64 acked;
+                u64 replayed;//entries dispatched again by Start()
+                u64 commits;//msync rounds
+                u64 full;//puts refused because the log was full
+                u64 refused;//puts refused by the pool
+                u64 failed;//entries whose handler threw
+                u64 dropped;//works the pool dropped unrun, dispatched again
+                u64 pending;//entries not acknowledged yet
+        };
+        /*
+          pool: runs the handlers, must outlive every Put()
+          path: log file, created when missing
+          size: bytes of the log, an existing log keeps its own size
+          commitUs: group commit period
+         */
+        DurableQueue(ThreadPoolExecutor *pool, const std::string &path,
+                     u64 size = 64 << 20, u32 commitUs = 1000);
+        /*
+          waits for the dispatched works to run or be dropped by the pool,
+          then commits the log a last time
+         */
+        ~DurableQueue();
+        /*
+          handler of the entries of type, only before Start()
+          return false when already started
+         */
+        bool Register(u32 type, const Handler &handler);
+        /*
+          map the log and replay what is left in it. Entries of types
+          without a handler are acknowledged and dropped.
+          return false when the log can not be opened or is corrupt
+         */
+        bool Start();
+        /*
+          append an entry, it is durable after the next group commit.
+          return false when not started, the type has no handler, len is
+          too big, the log is full or the pool refuses the work
+         */
+        bool Put(u32 type, const void *data, u32 len);
+        bool Put(u32 type, const std::string &payload) {
+                return Put(type, payload.data(), payload.size());
+        }
+        //wait until every entry put so far is durable
+        void Flush();
+        Stats GetStats();
+private:
+        struct FileHeader {
+                u64 magic;
+                u64 size;
+                u64 cursor;//offset of the first unacknowledged entry
+                u64 cseq;//its seq, written after cursor
+        };
+        struct Entry {
+                u32 len;//payload bytes
+                u32 type;
+                u64 seq;//consecutive from 1, stale entries have older ones
+                u32 sum;//checksum of the fields above and the payload
+                u32 flags;
+        };
+        enum {
+                WRAP = 1,//no payload, the next entry is at the start
+                CANCELLED = 2//refused by the pool, never run, not in the sum
+        };
+        static const u64 HDR = 4096;//the header has a page of its own
+        struct Slot {
+                u64 seq;
+                u64 off;
+        };
+        struct Ticket;
+        ThreadPoolExecutor *pool;
+        std::string path;
+        u64 size;
+        u32 cus;//commit period
+        int fd;
+        char *map;
+        FileHeader *hdr;
+        std::map<u32, Handler> handlers;//read only once started
+        std::mutex lock;
+        std::condition_variable cv;
+        bool started;
+        bool stop;
+        std::deque<Slot> slots;//entries behind the cursor, by seq
+        std::deque<Slot> redo;//replayed entries refused, works dropped
+        //ack flags by seq % nacks, set without the lock. The log never
+        //holds nacks entries, so a flag is cleared before its seq comes again
+        std::unique_ptr<std::atomic<bool>[]> acks;
+        u64 nacks;
+        u64 tail;//where the next entry goes
+        u64 nseq;//seq of the next entry
+        u64 sofs;//offset synced up to
+        u64 wraps;//times tail went back to the start
+        u64 swraps;//wraps when last synced
+        u64 durable;//entries below this seq are synced
+        bool adirty;//cursor moved since the last commit
+        std::atomic<u64> failed;//handlers that threw
+        std::atomic<u64> inflight;//works in the pool, run or not
+        bool flushing;
+        bool cidle;//committer waits for something to commit
+        Stats st;
+        std::thread committer;
+        void CommitLoop();
+        void SyncRange(u64 from, u64 to);
+        static u32 Checksum(const Entry *e, const char *data);
+        //make room for need bytes at tail, guarded by lock
+        bool Reserve(u64 need);
+        void Wrap();
+        void SetCursor();
+        //move the cursor past the acknowledged entries at the front
+        void Advance();
+        void Kick();
+        //put the work of an entry counted in inflight into the pool,
+        //return false when the pool refused it
+        bool Dispatch(const Slot &sl);
+        //give the entries in redo another try, guarded by lock
+        void Redispatch(std::unique_lock<std::mutex> &lk);
+        //the work of sl is gone, dropped: unrun after the pool accepted it
+        void Done(const Slot &sl, bool acked, bool dropped);
+};
@@ -0,0 +1,165 @@
+#include "Executor.h"
+#include <cassert>
+#include <system_error>
+#include <thread>
+
+ThreadPerTaskExecutor::ThreadPerTaskExecutor()
+        : live(0)
+{
+}
+
+ThreadPerTaskExecutor::~ThreadPerTaskExecutor()
+{
+        std::unique_lock<std::mutex> lk(lock);
+        doneCond.wait(lk, [this] {return live == 0;});
+}
+
+bool ThreadPerTaskExecutor::Execute(const std::function<void()> &task)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        try {
+                std::thread([this, task] () {
+                                //nobody to hand it to, but the thread must
+                                //still count itself out
+                                try {
+                                        task();
+                                } catch (...) {
+                                }
+                                std::lock_guard<std::mutex> lk(lock);
+                                if (--live == 0)
+                                        doneCond.notify_all();
+                        }).detach();
+        } catch (const std::system_error &) {
+                return false;
+        }
+        live++;
+        return true;
+}
+
+//a turn put, unscheduled when dropped unrun
+struct SerialQueue::Turn {
+        explicit Turn(const std::shared_ptr<State> &ast) : st(ast), armed(true) {}
+        ~Turn() {
+                if (!armed)
+                        return;
+                std::list<std::function<void()> > works;
+                {
+                        std::lock_guard<std::mutex> lk(st->lock);
+                        st->scheduled = false;
+                        works.swap(st->req_q);
+                }
+                //their destructors may call back into us
+        }
+        std::shared_ptr<State> st;
+        bool armed;
+};
+
+SerialQueue::SerialQueue(const Put &put, size_t batch)
+        : st(std::make_shared<State>())
+{
+        assert(batch != 0);
+        st->put = put;
+        st->batch = batch ? batch : 1;
+        st->scheduled = false;
+}
+
+bool SerialQueue::Execute(const std::function<void()> &task)
+{
+        std::unique_lock<std::mutex> lk(st->lock);
+        st->req_q.emplace_back(task);
+        if (st->scheduled)
+                return true;
+        st->scheduled = true;
+        auto mine = --st->req_q.end();
+        //an inline executor or an onReject may run the turn right here, it
+        //takes our lock
+        lk.unlock();
+        if (Schedule(st))
+                return true;
+        lk.lock();
+        //refused, nobody ran anything yet
+        st->req_q.erase(mine);
+        if (st->req_q.empty()) {
+                st->scheduled = false;
+                return false;
+        }
+        //others queued behind us meanwhile and were told yes, serve them
+        lk.unlock();
+        Run(st);
+        return false;
+}
+
+bool SerialQueue::Schedule(const std::shared_ptr<State> &st)
+{
+        auto t = std::make_shared<Turn>(st);
+        if (st->put([t] () {
+                                t->armed = false;
+                                Run(t->st);
+                        }))
+                return true;
+        //never got in, the caller takes over
+        t->armed = false;
+        return false;
+}
+
+size_t SerialQueue::GetPending()
+{
+        std::lock_guard<std::mutex> lk(st->lock);
+        return st->req_q.size();
+}
+
+void SerialQueue::Run(const std::shared_ptr<State> &st)
+{
+        std::list<std::function<void()> > works;
+        while (1) {
+                {
+                        std::lock_guard<std::mutex> lk(st->lock);
+                        assert(st->scheduled);
+                        auto end = st->req_q.begin();
+                        for (size_t i = 0; i < st->batch && end != st->req_q.end(); i++)
+                                end++;
+                        works.splice(works.end(), st->req_q, st->req_q.begin(), end);
+                }
+                try {
+                        while (!works.empty()) {
+                                auto work = std::move(works.front());
+                                works.pop_front();
+                                work();
+                        }
+                } catch (...) {
+                        //the works behind the one that threw keep their
+                        //place and get a new turn, the exception goes on to
+                        //whoever runs us
+                        std::unique_lock<std::mutex> lk(st->lock);
+                        st->req_q.splice(st->req_q.begin(), works);
+                        if (st->req_q.empty()) {
+                                st->scheduled = false;
+                                throw;
+                        }
+                        //still scheduled for the new turn
+                        lk.unlock();
+                        if (!Schedule(st)) {
+                                lk.lock();
+                                st->scheduled = false;
+                        }
+                        throw;
+                }
+                std::unique_lock<std::mutex> lk(st->lock);
+                if (st->req_q.empty()) {
+                        st->scheduled = false;
+                        return;
+                }
+                lk.unlock();
+                //give other works a chance before our next turn
+                if (Schedule(st))
+                        return;
+                //refused but still draining, finish our works here
+        }
+}
+
+SerialExecutor::SerialExecutor(Executor *under, size_t batch)
+        : q([under] (const std::function<void()> &turn) {return under->Execute(turn);},
+            batch)
+{
+        assert(under != nullptr);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+
+/*
+  Something that runs works. Code taking an Executor * can be handed a pool,
+  a strand or one of the cheap engines below, whichever fits the call site.
+  On hot paths take the executor as a template parameter instead, any type
+  with bool Execute(const std::function<void()> &) will do and the call is
+  bound at compile time (the engines below are final, so are calls through
+  their own type).
+ */
+class Executor {
+public:
+        virtual ~Executor() {}
+        /*
+          return false when the work is refused
+         */
+        virtual bool Execute(const std::function<void()> &task) = 0;
+        /*
+          run fn and hand its result, or its exception, over through a future.
+          A refused work leaves a future whose get() throws broken_promise
+         */
+        template<class F>
+        auto Submit(F fn) -> std::future<decltype(fn())>;
+};
+
+//Submit() for any executor type, no virtual call when Ex is a concrete type
+template<class Ex, class F>
+auto Submit(Ex &ex, F fn) -> std::future<decltype(fn())>
+{
+        typedef decltype(fn()) R;
+        auto pt = std::make_shared<std::packaged_task<R()> >(std::move(fn));
+        std::future<R> f = pt->get_future();
+        ex.Execute([pt] () {(*pt)();});
+        return f;
+}
+
+template<class F>
+auto Executor::Submit(F fn) -> std::future<decltype(fn())>
+{
+        return ::Submit(*this, std::move(fn));
+}
+
+//runs every work right away on the calling thread, for tiny continuations
+class InlineExecutor final : public Executor {
+public:
+        bool Execute(const std::function<void()> &task) override {
+                task();
+                return true;
+        }
+};
+
+/*
+  a new thread for every work, for rare long works that should not hold a
+  pool worker. An exception escaping a work is dropped. The destructor waits
+  for the works still running
+ */
+class ThreadPerTaskExecutor final : public Executor {
+public:
+        ThreadPerTaskExecutor();
+        ~ThreadPerTaskExecutor();
+        //return false when no thread could be created
+        bool Execute(const std::function<void()> &task) override;
+private:
+        std::mutex lock;
+        std::condition_variable doneCond;
+        size_t live;
+};
+
+/*
+  the turns behind SerialExecutor and Strand: works run one after another in
+  FIFO order and never overlap, up to batch of them per turn, each turn put
+  through put. A turn dropped unrun, its closure destroyed without being
+  called, drops the works pending with it and ends the turn, the next work
+  gets a new one
+ */
+class SerialQueue {
+public:
+        //put a turn, return false when refused
+        typedef std::function<bool(const std::function<void()> &)> Put;
+        SerialQueue(const Put &put, size_t batch);
+        //return false when the turn is refused
+        bool Execute(const std::function<void()> &task);
+        size_t GetPending();
+private:
+        //state shared with the turns put
+        struct State {
+                Put put;
+                size_t batch;
+                std::mutex lock;
+                std::list<std::function<void()> > req_q;
+                bool scheduled;//a turn is queued or running
+        };
+        std::shared_ptr<State> st;
+        struct Turn;
+        static bool Schedule(const std::shared_ptr<State> &st);
+        static void Run(const std::shared_ptr<State> &st);
+};
+
+/*
+  runs works one after another in FIFO order on top of another executor,
+  taking up to batch of them per turn. Like Strand, which does the same for a
+  ThreadPoolExecutor tenant. Works still pending when the serial executor is
+  destroyed are still run, the underlying executor must outlive them. A turn
+  the underlying executor drops unrun drops the pending works with it
+ */
+class SerialExecutor final : public Executor {
+public:
+        explicit SerialExecutor(Executor *under, size_t batch = 16);
+        //return false when the underlying executor refuses the turn
+        bool Execute(const std::function<void()> &task) override {
+                return q.Execute(task);
+        }
+        size_t GetPending() {
+                return q.GetPending();
+        }
+private:
+        SerialQueue q;
+};
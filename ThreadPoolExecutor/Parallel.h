@@ -0,0 +1,266 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <vector>
+#include "ThreadPoolExecutor.h"
+
+/*
+  Data parallel building blocks on top of a ThreadPoolExecutor. The calling
+  thread always takes part, so they are safe to call from a worker of the
+  same pool and never wait for a busy pool to get around to them: what no
+  worker picked up, the caller runs itself. Ranges need random access
+  iterators. Below the cutoffs the serial std algorithms are used.
+ */
+static const size_t PARALLEL_SORT_CUTOFF = 1 << 14;
+static const size_t PARALLEL_SCAN_CUTOFF = 1 << 15;
+
+//threads a parallel algorithm spreads over: the workers and the caller
+inline size_t ParallelWidth(ThreadPoolExecutor *pool)
+{
+        u32 n = pool->GetPoolSize();
+        return (n ? n : 1) + 1;
+}
+
+/*
+  run fn(i) for every i in [0, n), return when all are done
+ */
+template<class F>
+void ParallelFor(ThreadPoolExecutor *pool, size_t n, F fn)
+{
+        if (n == 0)
+                return;
+        struct State {
+                State() : next(0), done(0) {}
+                std::atomic<size_t> next;
+                std::atomic<size_t> done;
+                std::mutex lock;
+                std::condition_variable cv;
+        };
+        auto st = std::make_shared<State>();
+        //a helper starting late finds every index taken and never touches fn
+        F *pf = &fn;
+        auto body = [st, pf, n] () {
+                size_t i, ran = 0;
+                while ((i = st->next++) < n) {
+                        (*pf)(i);
+                        ran++;
+                }
+                if (ran && st->done.fetch_add(ran) + ran == n) {
+                        std::lock_guard<std::mutex> lk(st->lock);
+                        st->cv.notify_all();
+                }
+        };
+        size_t helpers = std::min(n, ParallelWidth(pool)) - 1;
+        for (size_t h = 0; h < helpers; h++)
+                if (!pool->Execute(body))
+                        break;//refused, we do the rest
+        body();
+        std::unique_lock<std::mutex> lk(st->lock);
+        st->cv.wait(lk, [&st, n] {return st->done == n;});
+}
+
+/*
+  merge the sorted a[0, na) and b[0, nb) and write outputs [k0, k1) of the
+  result to out[k0, k1). Ties take a first, pieces of one merge can run in
+  parallel
+ */
+template<class InIt, class OutIt, class Cmp>
+void ParallelMergePiece(InIt a, size_t na, InIt b, size_t nb, size_t k0, size_t k1,
+                        OutIt out, Cmp cmp)
+{
+        //how many of a are among the first k outputs
+        auto corank = [&] (size_t k) {
+                size_t lo = k > nb ? k - nb : 0, hi = std::min(k, na);
+                while (lo < hi) {
+                        size_t i = lo + (hi - lo) / 2;
+                        if (!cmp(b[k - i - 1], a[i]))
+                                lo = i + 1;
+                        else
+                                hi = i;
+                }
+                return lo;
+        };
+        size_t i0 = corank(k0), i1 = corank(k1);
+        std::merge(std::make_move_iterator(a + i0), std::make_move_iterator(a + i1),
+                   std::make_move_iterator(b + (k0 - i0)),
+                   std::make_move_iterator(b + (k1 - i1)), out + k0, cmp);
+}
+
+/*
+  like std::sort: runs sorted in parallel with std::sort, then merged in
+  rounds where every merge is cut into pieces by binary search so all
+  threads stay busy to the last round. Needs n default constructible
+  elements of scratch
+ */
+template<class It, class Cmp>
+void ParallelSort(ThreadPoolExecutor *pool, It first, It last, Cmp cmp)
+{
+        typedef typename std::iterator_traits<It>::value_type T;
+        size_t n = last - first;
+        size_t w = ParallelWidth(pool);
+        if (n <= PARALLEL_SORT_CUTOFF) {
+                std::sort(first, last, cmp);
+                return;
+        }
+        //a power of two, merge rounds pair them up evenly
+        size_t runs = 1;
+        while (runs < w * 2 && n / (runs * 2) >= PARALLEL_SORT_CUTOFF)
+                runs *= 2;
+        auto bound = [n, runs] (size_t r) {return (size_t)((u64)n * r / runs);};
+        ParallelFor(pool, runs, [&] (size_t r) {
+                        std::sort(first + bound(r), first + bound(r + 1), cmp);
+                });
+        if (runs == 1)
+                return;
+        std::vector<T> buf(n);
+        T *tmp = buf.data();
+        bool inbuf = false;//sorted runs are in buf
+        for (size_t width = 1; width < runs; width *= 2) {
+                //every round has runs pieces in total
+                size_t pieces = width * 2;
+                ParallelFor(pool, runs, [&] (size_t t) {
+                                size_t p = t / pieces, k = t % pieces;
+                                size_t lo = bound(p * pieces);
+                                size_t mid = bound(p * pieces + width);
+                                size_t hi = bound((p + 1) * pieces);
+                                size_t k0 = (hi - lo) * k / pieces;
+                                size_t k1 = (hi - lo) * (k + 1) / pieces;
+                                if (inbuf)
+                                        ParallelMergePiece(tmp + lo, mid - lo, tmp + mid, hi - mid,
+                                                           k0, k1, first + lo, cmp);
+                                else
+                                        ParallelMergePiece(first + lo, mid - lo, first + mid, hi - mid,
+                                                           k0, k1, tmp + lo, cmp);
+                        });
+                inbuf = !inbuf;
+        }
+        if (inbuf)
+                ParallelFor(pool, runs, [&] (size_t r) {
+                                std::move(tmp + bound(r), tmp + bound(r + 1), first + bound(r));
+                        });
+}
+
+template<class It>
+void ParallelSort(ThreadPoolExecutor *pool, It first, It last)
+{
+        ParallelSort(pool, first, last,
+                     std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+/*
+  serial kernels of the scans: plain indexed loops over one block without
+  calls or branches, a reduction of arithmetic types vectorizes
+ */
+template<class It, class T, class Op>
+T ParallelReduceLeaf(It in, size_t n, T acc, Op op)
+{
+        for (size_t i = 0; i < n; i++)
+                acc = op(acc, in[i]);
+        return acc;
+}
+
+template<class InIt, class OutIt, class T, class Op>
+void ParallelInclusiveLeaf(InIt in, size_t n, OutIt out, T acc, Op op)
+{
+        for (size_t i = 0; i < n; i++) {
+                acc = op(acc, in[i]);
+                out[i] = acc;
+        }
+}
+
+//in and out may be the same range
+template<class InIt, class OutIt, class T, class Op>
+void ParallelExclusiveLeaf(InIt in, size_t n, OutIt out, T acc, Op op)
+{
+        for (size_t i = 0; i < n; i++) {
+                T v = in[i];
+                out[i] = acc;
+                acc = op(acc, v);
+        }
+}
+
+/*
+  two pass blocked scan: the totals of all blocks in parallel, a serial
+  scan of those few totals, then every block scanned again in parallel from
+  its carry in. op must be associative. out may be first
+ */
+template<class InIt, class OutIt, class Op>
+OutIt ParallelInclusiveScan(ThreadPoolExecutor *pool, InIt first, InIt last,
+                            OutIt out, Op op)
+{
+        typedef typename std::iterator_traits<InIt>::value_type T;
+        size_t n = last - first;
+        if (n <= PARALLEL_SCAN_CUTOFF)
+                return std::partial_sum(first, last, out, op);
+        size_t blocks = std::min(ParallelWidth(pool) * 4, n / PARALLEL_SCAN_CUTOFF);
+        auto bound = [n, blocks] (size_t b) {return (size_t)((u64)n * b / blocks);};
+        //the last block is never needed as a carry
+        std::vector<T> sums(blocks);
+        ParallelFor(pool, blocks - 1, [&] (size_t b) {
+                        sums[b] = ParallelReduceLeaf(first + bound(b) + 1, bound(b + 1) - bound(b) - 1,
+                                                     T(first[bound(b)]), op);
+                });
+        for (size_t b = 1; b < blocks - 1; b++)
+                sums[b] = op(sums[b - 1], sums[b]);
+        ParallelFor(pool, blocks, [&] (size_t b) {
+                        size_t lo = bound(b), len = bound(b + 1) - lo;
+                        if (b == 0) {
+                                T acc = first[0];
+                                out[0] = acc;
+                                ParallelInclusiveLeaf(first + 1, len - 1, out + 1, acc, op);
+                        } else {
+                                ParallelInclusiveLeaf(first + lo, len, out + lo, sums[b - 1], op);
+                        }
+                });
+        return out + n;
+}
+
+template<class InIt, class OutIt>
+OutIt ParallelInclusiveScan(ThreadPoolExecutor *pool, InIt first, InIt last, OutIt out)
+{
+        return ParallelInclusiveScan(pool, first, last, out,
+                std::plus<typename std::iterator_traits<InIt>::value_type>());
+}
+
+//out[i] is init op first[0] op ... op first[i - 1]
+template<class InIt, class OutIt, class T, class Op>
+OutIt ParallelExclusiveScan(ThreadPoolExecutor *pool, InIt first, InIt last,
+                            OutIt out, T init, Op op)
+{
+        size_t n = last - first;
+        if (n <= PARALLEL_SCAN_CUTOFF) {
+                ParallelExclusiveLeaf(first, n, out, init, op);
+                return out + n;
+        }
+        size_t blocks = std::min(ParallelWidth(pool) * 4, n / PARALLEL_SCAN_CUTOFF);
+        auto bound = [n, blocks] (size_t b) {return (size_t)((u64)n * b / blocks);};
+        std::vector<T> sums(blocks);
+        ParallelFor(pool, blocks - 1, [&] (size_t b) {
+                        sums[b] = ParallelReduceLeaf(first + bound(b) + 1, bound(b + 1) - bound(b) - 1,
+                                                     T(first[bound(b)]), op);
+                });
+        //carry in of block b + 1
+        T acc = init;
+        for (size_t b = 0; b < blocks - 1; b++)
+                sums[b] = acc = op(acc, sums[b]);
+        ParallelFor(pool, blocks, [&] (size_t b) {
+                        size_t lo = bound(b);
+                        ParallelExclusiveLeaf(first + lo, bound(b + 1) - lo, out + lo,
+                                              b ? sums[b - 1] : init, op);
+                });
+        return out + n;
+}
+
+template<class InIt, class OutIt, class T>
+OutIt ParallelExclusiveScan(ThreadPoolExecutor *pool, InIt first, InIt last,
+                            OutIt out, T init)
+{
+        return ParallelExclusiveScan(pool, first, last, out, init, std::plus<T>());
+}
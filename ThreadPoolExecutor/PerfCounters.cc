@@ -0,0 +1,76 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+PerfCounters::PerfCounters()
+        : opened(false)
+{
+        for (int i = 0; i < COUNT; i++)
+                fds[i] = -1;
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+        for (int i = 0; i < COUNT; i++)
+                if (fds[i] >= 0)
+                        close(fds[i]);
+#endif
+}
+
+bool PerfCounters::Open()
+{
+#ifdef __linux__
+        static const struct {
+                u32 type;
+                u64 config;
+        } evs[COUNT] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+        };
+        bool any = false;
+        for (int i = 0; i < COUNT; i++) {
+                if (fds[i] >= 0) {
+                        any = true;
+                        continue;
+                }
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = evs[i].type;
+                attr.config = evs[i].config;
+                //software events all happen in the kernel, user only
+                //they would never count
+                attr.exclude_kernel = evs[i].type == PERF_TYPE_SOFTWARE ? 0 : 1;
+                attr.exclude_hv = 1;
+                //this thread only, on any cpu
+                fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+                if (fds[i] >= 0)
+                        any = true;
+        }
+        opened = true;//do not retry on every work
+        return any;
+#else
+        opened = true;
+        return false;
+#endif
+}
+
+void PerfCounters::Read(u64 v[COUNT])
+{
+        for (int i = 0; i < COUNT; i++) {
+                v[i] = 0;
+#ifdef __linux__
+                if (fds[i] >= 0 && read(fds[i], &v[i], sizeof(v[i])) != sizeof(v[i]))
+                        v[i] = 0;
+#endif
+        }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include "ThreadPoolExecutor.h"
+
+/*
+  Hardware and software counters of the calling thread, opened with
+  perf_event_open(2). Each counter is opened on its own so that a machine
+  without a PMU(most VMs) still gets the software ones. Counters that can not
+  be opened(not Linux, perf_event_paranoid, seccomp ...) always read 0.
+  Context switches and migrations happen in the kernel, they are only
+  opened when the kernel side may be counted.
+ */
+class PerfCounters {
+public:
+        enum {CYCLES, INSTRUCTIONS, LLC_MISSES, CTX_SWITCHES, MIGRATIONS, COUNT};
+        PerfCounters();
+        ~PerfCounters();
+        /*
+          open counters for the calling thread
+          return false when no counter at all could be opened
+         */
+        bool Open();
+        bool IsOpen() const {return opened;}
+        //current value of every counter
+        void Read(u64 v[COUNT]);
+private:
+        int fds[COUNT];
+        bool opened;
+};
@@ -0,0 +1,230 @@
+#include "Pipeline.h"
+#include <cassert>
+
+//works of any pipeline run in place by the calling thread, deferred while
+//it is already inside one so running in place never nests
+static thread_local std::deque<std::function<void()> > *tl_inline = nullptr;
+//inside pool->Execute() of Spawn(), a work run now is run by onReject
+static thread_local bool tl_spawning = false;
+
+Pipeline::Pipeline(ThreadPoolExecutor *apool, u32 maxTokens, u32 atenant)
+        : pool(apool),
+          tenant(atenant),
+          max(maxTokens ? maxTokens : 1),
+          running(false),
+          pumping(false),
+          eof(false),
+          inflight(0),
+          peak(0),
+          seq(0),
+          done(0)
+{
+        assert(pool != nullptr);
+        assert(maxTokens != 0);
+}
+
+void Pipeline::AddStage(Mode mode, const Filter &filter)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        assert(!running);
+        assert(!stages.empty() || mode != PARALLEL);
+        Stage *s = new Stage();
+        s->mode = mode;
+        s->filter = filter;
+        s->busy = false;
+        s->next = 0;
+        if (mode == SERIAL_IN_ORDER)
+                s->ring.resize(max, std::make_pair((void *)nullptr, false));
+        stages.emplace_back(s);
+}
+
+u64 Pipeline::Run()
+{
+        std::unique_lock<std::mutex> lk(lock);
+        assert(!running && !stages.empty());
+        running = true;
+        pumping = true;
+        eof = false;
+        inflight = 0;
+        peak = 0;
+        seq = 0;
+        done = 0;
+        error = nullptr;
+        for (auto &s : stages)
+                s->next = 0;
+        lk.unlock();
+        //we would hold the worker the works below may wait for
+        assert(ThreadPoolExecutor::Current() != pool);
+        Spawn([this] () {Pump();});
+        lk.lock();
+        doneCond.wait(lk, [this] {return eof && inflight == 0;});
+        running = false;
+        if (error) {
+                auto e = error;
+                error = nullptr;
+                std::rethrow_exception(e);
+        }
+        return done;
+}
+
+u32 Pipeline::GetPeakTokens()
+{
+        std::lock_guard<std::mutex> lk(lock);
+        return peak;
+}
+
+void *Pipeline::Call(Stage &s, void *item)
+{
+        try {
+                return s.filter(item);
+        } catch (...) {
+                std::lock_guard<std::mutex> lk(lock);
+                if (!error)
+                        error = std::current_exception();
+                return nullptr;
+        }
+}
+
+template<class F>
+void Pipeline::Spawn(const F &fn)
+{
+        //an onReject of the pool may run it right here, Pump() and Flow()
+        //spawning each other that way would nest without end. fn is
+        //captured as is, the pool allocates once for both
+        auto wrapped = [fn] () {
+                if (tl_spawning)
+                        RunInPlace(fn);
+                else
+                        fn();
+        };
+        bool was = tl_spawning;
+        tl_spawning = true;
+        bool ok = pool->Execute(tenant, wrapped);
+        tl_spawning = was;
+        //pool is quitting but still draining, do it here
+        if (!ok)
+                RunInPlace(fn);
+}
+
+void Pipeline::RunInPlace(const std::function<void()> &fn)
+{
+        if (tl_inline) {
+                tl_inline->push_back(fn);
+                return;
+        }
+        struct Loop {
+                Loop() {tl_inline = &later;}
+                ~Loop() {tl_inline = nullptr;}
+                std::deque<std::function<void()> > later;
+        } loop;
+        bool was = tl_spawning;
+        tl_spawning = false;
+        fn();
+        while (!loop.later.empty()) {
+                auto next = std::move(loop.later.front());
+                loop.later.pop_front();
+                next();
+        }
+        tl_spawning = was;
+}
+
+void Pipeline::Pump()
+{//called with a token left
+        bool failed;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                failed = error != nullptr;
+        }
+        //a failed filter ends the input
+        void *item = failed ? nullptr : Call(*stages[0], nullptr);
+        std::unique_lock<std::mutex> lk(lock);
+        if (item == nullptr) {
+                eof = true;
+                pumping = false;
+                if (inflight == 0)
+                        doneCond.notify_all();
+                return;
+        }
+        u64 sq = seq++;
+        inflight++;
+        if (inflight > peak)
+                peak = inflight;
+        //let another worker go on reading while we carry the item, with no
+        //token left the next item leaving the pipeline restarts the input
+        bool more = inflight < max;
+        if (!more)
+                pumping = false;
+        lk.unlock();
+        if (more)
+                Spawn([this] () {Pump();});
+        Flow(item, sq, 1, false);
+}
+
+void Pipeline::Flow(void *item, u64 sq, size_t i, bool admitted)
+{
+        for (; i < stages.size(); i++) {
+                Stage &s = *stages[i];
+                if (s.mode == PARALLEL) {
+                        if (item)
+                                item = Call(s, item);
+                        continue;
+                }
+                if (!admitted) {
+                        std::lock_guard<std::mutex> lk(s.lock);
+                        if (s.mode == SERIAL_IN_ORDER && (s.busy || sq != s.next)) {
+                                s.ring[sq % max] = std::make_pair(item, true);
+                                return;
+                        }
+                        if (s.mode == SERIAL_OUT_OF_ORDER && s.busy) {
+                                s.fifo.emplace_back(item, sq);
+                                return;
+                        }
+                        s.busy = true;
+                }
+                admitted = false;
+                if (item)
+                        item = Call(s, item);
+                //hand the stage over to the next parked item, if any
+                bool have = false;
+                void *ni = nullptr;
+                u64 ns = 0;
+                {
+                        std::lock_guard<std::mutex> lk(s.lock);
+                        if (s.mode == SERIAL_IN_ORDER) {
+                                s.next++;
+                                auto &slot = s.ring[s.next % max];
+                                if (slot.second) {
+                                        have = true;
+                                        ni = slot.first;
+                                        ns = s.next;
+                                        slot = std::make_pair((void *)nullptr, false);
+                                }
+                        } else if (!s.fifo.empty()) {
+                                have = true;
+                                ni = s.fifo.front().first;
+                                ns = s.fifo.front().second;
+                                s.fifo.pop_front();
+                        }
+                        if (!have)
+                                s.busy = false;
+                }
+                if (have)
+                        Spawn([this, ni, ns, i] () {Flow(ni, ns, i, true);});
+        }
+        Exit();
+}
+
+void Pipeline::Exit()
+{
+        std::unique_lock<std::mutex> lk(lock);
+        done++;
+        inflight--;
+        if (eof || pumping) {
+                if (eof && inflight == 0)
+                        doneCond.notify_all();
+                return;
+        }
+        pumping = true;
+        lk.unlock();
+        Spawn([this] () {Pump();});
+}
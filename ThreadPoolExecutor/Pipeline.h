@@ -0,0 +1,95 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <deque>
+#include "ThreadPoolExecutor.h"
+
+/*
+  A chain of stages run on a shared ThreadPoolExecutor, items flow from the
+  first stage to the last. At most maxTokens items are in flight at a time,
+  the input stage is not called again until an item has left the last stage,
+  so a slow stage holds back the input instead of letting queues grow.
+  A worker carries its item as far down the chain as it can: parallel stages
+  and idle serial stages run right away on the same worker, only an item that
+  has to wait for a busy serial stage is parked and later picked up by
+  another work of the pool.
+  Stages work on opaque void * items, the first stage is the input and is
+  called with nullptr, it returns nullptr at the end of input. A later stage
+  returning nullptr drops the item, the remaining stages are skipped for it.
+  The last stage owns whatever is left of the item. A filter that throws
+  drops its item and ends the input, Run() rethrows the first such
+  exception once the items in flight are through.
+  Every work the pipeline puts into the pool must run: an onReject of the
+  pool may run it on the spot, but must not drop it.
+ */
+class Pipeline {
+public:
+        enum Mode {
+                SERIAL_IN_ORDER,//one at a time, in the order of the input
+                SERIAL_OUT_OF_ORDER,//one at a time, in any order
+                PARALLEL,//any number at a time
+        };
+        typedef std::function<void *(void *)> Filter;
+        /*
+          pool: pool running the stages, must outlive the pipeline
+          maxTokens: maximum number of items in flight, must be greater than 0
+          tenant: tenant id used when putting works into the pool
+         */
+        Pipeline(ThreadPoolExecutor *pool, u32 maxTokens, u32 tenant = 0);
+        /*
+          the first stage is the input and must be serial. Stages can not be
+          added while running
+         */
+        void AddStage(Mode mode, const Filter &filter);
+        /*
+          run until the input ends and every item left the last stage. Not
+          from a worker of pool, it would wait for works that may need it.
+          return the number of items that went through, dropped ones included
+         */
+        u64 Run();
+        /*
+          return the highest number of items in flight seen by the last Run()
+         */
+        u32 GetPeakTokens();
+private:
+        struct Stage {
+                Mode mode;
+                Filter filter;
+                std::mutex lock;
+                bool busy;//serial stage running an item
+                u64 next;//in order stage, seq of the next item to run
+                //in order stage, parked items indexed by seq % maxTokens. No
+                //more than maxTokens items are in flight and all of them with
+                //seq >= next are still in front of this stage, so slots never
+                //collide and reordering needs no search
+                std::vector<std::pair<void *, bool> > ring;
+                std::deque<std::pair<void *, u64> > fifo;//out of order stage
+        };
+        ThreadPoolExecutor *pool;
+        u32 tenant;
+        u32 max;
+        std::vector<std::unique_ptr<Stage> > stages;
+        std::mutex lock;
+        std::condition_variable doneCond;
+        bool running;
+        bool pumping;//input stage is running or scheduled
+        bool eof;
+        u32 inflight;
+        u32 peak;
+        u64 seq;//next seq handed out by the input
+        u64 done;
+        std::exception_ptr error;//first exception of a filter
+        //call the filter of s, nullptr when it threw
+        void *Call(Stage &s, void *item);
+        template<class F> void Spawn(const F &fn);
+        //run fn, or queue it behind the one the thread is running already
+        static void RunInPlace(const std::function<void()> &fn);
+        //run the input as long as tokens are left
+        void Pump();
+        //carry item from stage i on, admitted means it already owns stage i
+        void Flow(void *item, u64 sq, size_t i, bool admitted);
+        void Exit();
+};
@@ -0,0 +1,195 @@
+#include "Reactor.h"
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cassert>
+
+//an event put into the pool, holds a reference on its registration until
+//the pool is done with it, run, thrown or dropped
+struct Reactor::Event {
+        Event(Reg *ar, u32 aev) : r(ar), events(aev), ran(false) {
+                r->ref++;
+        }
+        ~Event() {
+                //nobody else would arm a one-shot fd the pool dropped
+                if (!ran && r->oneshot) {
+                        std::lock_guard<std::mutex> lk(r->olk);
+                        if (r->owner)
+                                r->owner->Rearm(r);
+                }
+                Release(r);
+        }
+        Reg *r;
+        u32 events;
+        std::atomic<bool> ran;//or refused, the fd stays disarmed
+};
+
+Reactor::Reactor(ThreadPoolExecutor *apool, u32 atenant)
+        : pool(apool),
+          tenant(atenant),
+          stop(false),
+          dispatched(0)
+{
+        ep = epoll_create1(EPOLL_CLOEXEC);
+        efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(ep >= 0 && efd >= 0);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;//nullptr marks the wakeup eventfd
+        epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev);
+        th = std::thread(&Reactor::Loop, this);
+}
+
+Reactor::~Reactor()
+{
+        stop = true;
+        Wakeup();
+        th.join();
+        //events still in the pool must not arm through us any more
+        auto orphan = [] (Reg *r) {
+                {
+                        std::lock_guard<std::mutex> lk(r->olk);
+                        r->owner = nullptr;
+                }
+                Release(r);
+        };
+        for (auto &it : regs)
+                orphan(it.second);
+        for (auto r : zombies)
+                orphan(r);
+        close(efd);
+        close(ep);
+}
+
+bool Reactor::Add(int fd, u32 events, const Handler &handler, bool oneshot)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (regs.count(fd))
+                return false;
+        Reg *r = new Reg();
+        r->fd = fd;
+        r->oneshot = oneshot;
+        r->events = events;
+        r->handler = handler;
+        r->ref = 1;
+        r->owner = this;
+        epoll_event ev;
+        ev.events = events | (oneshot ? EPOLLONESHOT : 0);
+        ev.data.ptr = r;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                delete r;
+                return false;
+        }
+        regs[fd] = r;
+        return true;
+}
+
+bool Reactor::Rearm(int fd, u32 events)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = regs.find(fd);
+        if (it == regs.end())
+                return false;
+        epoll_event ev;
+        ev.events = events | (it->second->oneshot ? EPOLLONESHOT : 0);
+        ev.data.ptr = it->second;
+        it->second->events = events;
+        return epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void Reactor::Rearm(Reg *r)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        //the fd may be registered again by now, that is another Reg
+        auto it = regs.find(r->fd);
+        if (it == regs.end() || it->second != r)
+                return;
+        epoll_event ev;
+        ev.events = r->events | EPOLLONESHOT;
+        ev.data.ptr = r;
+        epoll_ctl(ep, EPOLL_CTL_MOD, r->fd, &ev);
+}
+
+bool Reactor::Remove(int fd)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        auto it = regs.find(fd);
+        if (it == regs.end())
+                return false;
+        epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+        //the reactor thread may still hold events of this fd, let it drop
+        //its reference after the current batch
+        zombies.push_back(it->second);
+        regs.erase(it);
+        Wakeup();
+        return true;
+}
+
+void Reactor::Wakeup()
+{
+        u64 one = 1;
+        ssize_t r = write(efd, &one, sizeof(one));
+        (void)r;
+}
+
+u64 Reactor::GetDispatched()
+{
+        return dispatched;
+}
+
+void Reactor::Release(Reg *r)
+{
+        if (--r->ref == 0)
+                delete r;
+}
+
+void Reactor::Loop()
+{
+        const int N = 64;
+        epoll_event evs[N];
+        std::vector<std::function<void()> > batch;
+        std::vector<std::shared_ptr<Event> > held;
+        std::vector<Reg *> dead;
+        while (!stop) {
+                int n = epoll_wait(ep, evs, N, -1);
+                for (int i = 0; i < n; i++) {
+                        Reg *r = (Reg *)evs[i].data.ptr;
+                        u32 events = evs[i].events;
+                        if (r == nullptr) {
+                                u64 cnt;
+                                ssize_t rd = read(efd, &cnt, sizeof(cnt));
+                                (void)rd;
+                                continue;
+                        }
+                        auto e = std::make_shared<Event>(r, events);
+                        held.push_back(e);
+                        batch.emplace_back([e] () {
+                                        e->ran = true;
+                                        e->r->handler(e->r->fd, e->events);
+                                });
+                }
+                if (!batch.empty()) {
+                        //the events go with their holders whatever happens
+                        if (pool->ExecuteBatch(batch, tenant)) {
+                                dispatched += batch.size();
+                        } else {
+                                for (auto &e : held)
+                                        e->ran = true;
+                        }
+                        batch.clear();
+                        held.clear();
+                }
+                {
+                        std::lock_guard<std::mutex> lk(lock);
+                        dead.swap(zombies);
+                }
+                for (auto r : dead)
+                        Release(r);
+                dead.clear();
+        }
+}
+
+#endif
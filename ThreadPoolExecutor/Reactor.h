@@ -0,0 +1,81 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#ifdef __linux__
+
+#include <atomic>
+#include "ThreadPoolExecutor.h"
+
+/*
+  An epoll based event source feeding a ThreadPoolExecutor. One reactor
+  thread waits for readiness of the registered fds and puts every batch of
+  ready events into the pool with a single ExecuteBatch(), handlers then run
+  on pool workers.
+  By default registrations are one-shot: after an event is dispatched the fd
+  is disarmed until Rearm() is called, usually at the end of the handler, so
+  a handler never runs concurrently with itself. A one-shot event the pool
+  accepts and then drops unrun(an onReject that lets it go, Shutdown(true))
+  arms its fd again, as long as the reactor and the registration are there.
+ */
+class Reactor {
+public:
+        //fd, ready events(EPOLLIN, EPOLLOUT ...)
+        typedef std::function<void(int, u32)> Handler;
+        /*
+          pool: the pool running the handlers, must outlive the reactor
+          tenant: tenant id used when putting handlers into the pool
+         */
+        Reactor(ThreadPoolExecutor *pool, u32 tenant = 0);
+        /*
+          stops the reactor thread, handlers already put into the pool would
+          still be run
+         */
+        ~Reactor();
+        /*
+          return false when the fd is already registered or epoll refused it
+         */
+        bool Add(int fd, u32 events, const Handler &handler, bool oneshot = true);
+        /*
+          arm a one-shot fd again, events may differ from the registered ones
+         */
+        bool Rearm(int fd, u32 events);
+        bool Remove(int fd);
+        /*
+          wake up the reactor thread, thread safe and async-signal-safe
+         */
+        void Wakeup();
+        /*
+          return the number of events put into the pool so far
+         */
+        u64 GetDispatched();
+private:
+        struct Reg {
+                int fd;
+                bool oneshot;
+                u32 events;//last armed, guarded by lock
+                Handler handler;
+                std::atomic<u32> ref;//reactor plus every dispatched event
+                std::mutex olk;
+                Reactor *owner;//nullptr once the reactor is gone, guarded by olk
+        };
+        struct Event;
+        ThreadPoolExecutor *pool;
+        u32 tenant;
+        int ep;//epoll fd
+        int efd;//eventfd used by Wakeup()
+        std::mutex lock;
+        std::map<int, Reg *> regs;
+        std::vector<Reg *> zombies;//removed, released by the reactor thread
+        std::atomic<bool> stop;
+        std::atomic<u64> dispatched;
+        std::thread th;
+        void Loop();
+        //arm r again with its last events unless it was removed
+        void Rearm(Reg *r);
+        static void Release(Reg *r);
+};
+
+#endif
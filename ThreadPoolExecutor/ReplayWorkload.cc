@@ -0,0 +1,63 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+using namespace std;
+
+#include "ThreadPoolExecutor.h"
+#include "Workload.h"
+
+/*
+  replay a trace written by FlushWorkload() against one pool configuration:
+
+  replay <trace> [fixed|cached|sharded|partitioned] [threads] [speed]
+
+  defaults to a fixed pool of 4 threads at the recorded speed, speed 2 puts
+  the works twice as fast with half their running time
+ */
+int rmain(int argc, char **argv)
+{
+        if (argc < 2) {
+                cerr << "usage: " << argv[0]
+                     << " <trace> [fixed|cached|sharded|partitioned] [threads] [speed]" << endl;
+                return 2;
+        }
+        std::vector<WorkloadRecord> recs;
+        if (!ReadWorkload(argv[1], recs)) {
+                cerr << "can not read trace " << argv[1] << endl;
+                return 1;
+        }
+        string kind = argc > 2 ? argv[2] : "fixed";
+        u32 threads = argc > 3 ? atoi(argv[3]) : 4;
+        double speed = argc > 4 ? atof(argv[4]) : 1.0;
+        if (threads == 0)
+                threads = 1;
+        ThreadPoolExecutor *pool;
+        if (kind == "fixed") {
+                pool = ThreadPoolExecutor::NewFixedThreadPool(threads);
+        } else if (kind == "cached") {
+                pool = ThreadPoolExecutor::NewCachedThreadPool();
+        } else if (kind == "sharded") {
+                pool = ThreadPoolExecutor::NewShardedThreadPool(threads);
+        } else if (kind == "partitioned") {
+                pool = ThreadPoolExecutor::NewPartitionedThreadPool(threads);
+        } else {
+                cerr << "unknown pool " << kind << endl;
+                return 2;
+        }
+        auto rp = ReplayWorkload(pool, recs, speed);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+        cout << kind << " " << threads << " threads, speed " << speed << endl
+             << "works: " << rp.works << " of " << recs.size()
+             << " from " << rp.submitters << " submitters, "
+             << rp.dropped << " dropped" << endl
+             << "seconds: " << rp.seconds << endl
+             << "throughput: " << (u64)rp.throughput << " works/sec" << endl
+             << "queue delay us: p50 " << rp.waitP50 << " p90 " << rp.waitP90
+             << " p99 " << rp.waitP99 << " p99.9 " << rp.waitP999
+             << " max " << rp.waitMax << endl
+             << "threads: peak " << rp.peakThreads << " avg " << rp.avgThreads
+             << " peak active " << rp.peakActive << endl;
+        return 0;
+}
@@ -0,0 +1,10 @@
+#include "Strand.h"
+#include <cassert>
+
+Strand::Strand(ThreadPoolExecutor *pool, u32 batch, u32 tenant)
+        : q([pool, tenant] (const std::function<void()> &turn) {
+                        return pool->Execute(tenant, turn);
+                }, batch)
+{
+        assert(pool != nullptr);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <memory>
+#include "ThreadPoolExecutor.h"
+
+/*
+  A Strand is a serial executor multiplexed over a shared ThreadPoolExecutor.
+  Works put into one strand run one after another in FIFO order and never
+  overlap, but they borrow whatever worker of the parent pool is free instead
+  of owning a thread. The strand only occupies the pool while it has pending
+  works, and each turn runs up to batch works before handing the worker back,
+  so thousands of strands cost no more threads than the pool itself.
+  A strand may be destroyed while it still has pending works, those works
+  would still be run by the pool. A turn the pool drops unrun, by
+  Shutdown(true) or an onReject that does not run it, drops the works
+  pending in the strand with it.
+ */
+class Strand final : public Executor {
+public:
+        /*
+          pool: parent pool, must outlive every work put into this strand
+          batch: maximum number of works run per turn, must be greater than 0
+          tenant: tenant id used when the strand is scheduled onto the pool
+         */
+        Strand(ThreadPoolExecutor *pool, u32 batch = 16, u32 tenant = 0);
+        /*
+          return false when the parent pool does not accept new works
+         */
+        bool Execute(const std::function<void()> &task) override {
+                return q.Execute(task);
+        }
+        /*
+          return the number of works not yet started
+         */
+        u32 GetPending() {
+                return q.GetPending();
+        }
+private:
+        SerialQueue q;
+};
@@ -0,0 +1,217 @@
+#include "Sync.h"
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(std::atomic<u32>) == sizeof(u32), "futex word must be a plain u32");
+
+//waits of this thread helping their pool, one inside the other. Every
+//level holds the frames of a waiting work on the stack
+static thread_local u32 tl_helping = 0;
+static const u32 MAX_HELPING = 8;
+
+static inline u64 now_ns()
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef __linux__
+void SyncWaitable::Park(std::atomic<u32> &word, u32 v, u64 ns)
+{
+        struct timespec ts, *tp = nullptr;
+        if (ns != FOREVER) {
+                ts.tv_sec = ns / 1000000000;
+                ts.tv_nsec = ns % 1000000000;
+                tp = &ts;
+        }
+        //returns at once when word is no longer v
+        syscall(SYS_futex, (u32 *)&word, FUTEX_WAIT_PRIVATE, v, tp, nullptr, 0);
+}
+
+void SyncWaitable::Wake(std::atomic<u32> &word)
+{
+        syscall(SYS_futex, (u32 *)&word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+//no futex, waiters park on the condition variable of a bucket picked by
+//the address of the word
+struct ParkBucket {
+        std::mutex lock;
+        std::condition_variable cv;
+};
+static ParkBucket park_buckets[64];
+
+static inline ParkBucket &bucket_of(const void *p)
+{
+        return park_buckets[((uintptr_t)p >> 4) % 64];
+}
+
+void SyncWaitable::Park(std::atomic<u32> &word, u32 v, u64 ns)
+{
+        ParkBucket &b = bucket_of(&word);
+        std::unique_lock<std::mutex> lk(b.lock);
+        //a waker changes word before it takes the bucket lock
+        if (word.load() != v)
+                return;
+        if (ns == FOREVER)
+                b.cv.wait(lk);
+        else
+                b.cv.wait_for(lk, std::chrono::nanoseconds(ns));
+}
+
+void SyncWaitable::Wake(std::atomic<u32> &word)
+{
+        ParkBucket &b = bucket_of(&word);
+        std::lock_guard<std::mutex> lk(b.lock);
+        b.cv.notify_all();
+}
+#endif
+
+u64 SyncWaitable::DefaultSpin()
+{
+        static const u64 ns = (std::thread::hardware_concurrency() > 1) ? 20 * 1000 : 0;
+        return ns;
+}
+
+SyncWaitable::~SyncWaitable()
+{
+        while (waking.load() > 0)
+                std::this_thread::yield();
+}
+
+bool SyncWaitable::WaitOn(std::atomic<u32> &word, const std::function<bool()> &ready,
+                          u64 timeoutNs)
+{
+        if (ready())
+                return true;
+        u64 start = now_ns();
+        u64 deadline = (timeoutNs == FOREVER) ? FOREVER : start + timeoutNs;
+        //spin, backing off from 1 to 64 pauses like Semaphore
+        u64 spin = spn.load(std::memory_order_relaxed);
+        u32 backoff = 1;
+        while (spin) {
+                if (ready())
+                        return true;
+                for (u32 i = 0; i < backoff; i++)
+                        cpu_relax();
+                if (backoff < 64)
+                        backoff <<= 1;
+                else
+                        std::this_thread::yield();//share a busy core
+                u64 now = now_ns();
+                if (now - start >= spin || now >= deadline)
+                        break;
+        }
+        //a worker helps its pool with what is pending instead
+        ThreadPoolExecutor *pool = ThreadPoolExecutor::Current();
+        if (pool) {
+                //deeper waiters only run the rest of their own batch, no
+                //other worker could take it, then park
+                bool own = tl_helping >= MAX_HELPING;
+                struct Help {
+                        Help() {tl_helping++;}
+                        ~Help() {tl_helping--;}
+                } help;
+                while (!ready()) {
+                        if (now_ns() >= deadline)
+                                return false;
+                        if (!pool->RunQueued(own))
+                                break;
+                }
+        }
+        if (ready())
+                return true;
+        if (pool)
+                pool->BeginBlocking();
+        bool ok;
+        while (1) {
+                waiters++;
+                u32 v = word.load();
+                ok = ready();
+                u64 now = now_ns();
+                if (ok || now >= deadline) {
+                        waiters--;
+                        break;
+                }
+                Park(word, v, (deadline == FOREVER) ? FOREVER : deadline - now);
+                waiters--;
+        }
+        if (pool)
+                pool->EndBlocking();
+        return ok;
+}
+
+void Latch::CountDown(u32 n)
+{
+        Publish(cnt, [this, n] () {
+                        u32 c = cnt.load();
+                        //never below 0, extra count downs are ignored
+                        while (c > 0 && !cnt.compare_exchange_weak(c, c > n ? c - n : 0))
+                                ;
+                        return c > 0 && c <= n;
+                });
+}
+
+bool Latch::WaitFor(u32 timeoutMs)
+{
+        return WaitOn(cnt, [this] () {return cnt.load() == 0;},
+                      timeoutMs ? (u64)timeoutMs * 1000000 : FOREVER);
+}
+
+Barrier::Barrier(u32 parties, const std::function<void()> &completion)
+        : pts(parties ? parties : 1),
+          fn(completion),
+          arrived(0),
+          gen(0)
+{
+}
+
+bool Barrier::ArriveAndWait()
+{
+        u32 g = gen.load();
+        if (arrived.fetch_add(1) + 1 == pts) {
+                //nobody arrives for the next phase before gen moves
+                arrived = 0;
+                if (fn)
+                        fn();
+                Publish(gen, [this] () {
+                                gen++;
+                                return true;
+                        });
+                return true;
+        }
+        WaitOn(gen, [this, g] () {return gen.load() != g;}, FOREVER);
+        return false;
+}
+
+void Event::Set()
+{
+        Publish(st, [this] () {
+                        u32 s = st.load();
+                        //set and count, waiters that came while it was
+                        //reset see the count move even after a Reset()
+                        while (!(s & 1) && !st.compare_exchange_weak(s, (s | 1) + 2))
+                                ;
+                        return !(s & 1);
+                });
+}
+
+void Event::Reset()
+{
+        st &= ~1u;
+}
+
+bool Event::WaitFor(u32 timeoutMs)
+{
+        u32 s = st.load();
+        return WaitOn(st, [this, s] () {
+                        u32 now = st.load();
+                        //set, or set and reset since we came
+                        return (now & 1) || (now >> 1) != (s >> 1);
+                }, timeoutMs ? (u64)timeoutMs * 1000000 : FOREVER);
+}
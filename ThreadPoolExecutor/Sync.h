@@ -0,0 +1,127 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include "ThreadPoolExecutor.h"
+
+/*
+  Latch, Barrier and Event for works and the threads around them. A waiter
+  spins for a while, then parks on a futex(a condition variable where there
+  is no futex). Every state change wakes parked waiters with one syscall,
+  and none at all when nobody is parked.
+  A waiter that is a worker of a ThreadPoolExecutor does not just sleep: it
+  runs works pending in its pool with RunQueued() until the wait is over or
+  nothing is left, and parks inside BeginBlocking()/EndBlocking() so the pool
+  may start a replacement. So a pool of n workers never deadlocks on works
+  waiting for works queued behind them, as long as no work helped out that
+  way waits for the very work it runs inside of. Works helped out may wait
+  and help in turn, up to 8 waits deep on one worker. Deeper waiters only
+  finish the batch of their worker before they park, so the stack of a
+  worker never holds more than 8 waits plus one batch.
+ */
+class SyncWaitable {
+public:
+        //spin up to spinUs before parking, 0 parks at once. The default is
+        //20us, 0 on a single cpu where the waker can not run while we spin
+        void SetSpin(u32 spinUs) {
+                spn = (u64)spinUs * 1000;
+        }
+protected:
+        static const u64 FOREVER = ~0ULL;
+        SyncWaitable() : waiters(0), waking(0), spn(DefaultSpin()) {}
+        //waits for the threads still inside Publish()
+        ~SyncWaitable();
+        /*
+          wait until ready() or timeoutNs, word changes with every change
+          ready() may see. return ready()
+         */
+        bool WaitOn(std::atomic<u32> &word, const std::function<bool()> &ready,
+                    u64 timeoutNs);
+        //change() the state, wake the waiters parked on word when it returns true
+        template<class F>
+        void Publish(std::atomic<u32> &word, F change) {
+                waking++;
+                //pairs with waiters++ then word.load() of a parking waiter,
+                //one of the two sees the other
+                if (change() && waiters.load() > 0)
+                        Wake(word);
+                waking--;
+        }
+private:
+        std::atomic<u32> waiters;//parked or about to park
+        std::atomic<u32> waking;//inside Publish(), the object must stay
+        std::atomic<u64> spn;//spin budget, ns
+        static u64 DefaultSpin();
+        static void Park(std::atomic<u32> &word, u32 v, u64 ns);
+        static void Wake(std::atomic<u32> &word);
+};
+
+/*
+  single use count down latch: Wait() returns once CountDown() was called
+  count times in total
+ */
+class Latch : public SyncWaitable {
+public:
+        explicit Latch(u32 count) : cnt(count) {}
+        void CountDown(u32 n = 1);
+        bool TryWait() {
+                return cnt.load() == 0;
+        }
+        void Wait() {
+                WaitFor(0);
+        }
+        //timeoutMs == 0 waits forever, return false on timeout
+        bool WaitFor(u32 timeoutMs);
+        void ArriveAndWait(u32 n = 1) {
+                CountDown(n);
+                Wait();
+        }
+private:
+        std::atomic<u32> cnt;
+};
+
+/*
+  reusable barrier of a fixed number of parties. The last one to arrive in
+  a phase runs the completion function before anyone is released, so it
+  sees every write made before the others arrived
+ */
+class Barrier : public SyncWaitable {
+public:
+        explicit Barrier(u32 parties,
+                         const std::function<void()> &completion = nullptr);
+        //return true on the thread that completed the phase
+        bool ArriveAndWait();
+        //phases completed so far
+        u32 GetPhase() {
+                return gen.load();
+        }
+private:
+        u32 pts;
+        std::function<void()> fn;
+        std::atomic<u32> arrived;
+        std::atomic<u32> gen;
+};
+
+/*
+  manual reset event: Set() releases every waiter and lets later waits
+  through until Reset(). A waiter is released by a Set() even when a Reset()
+  comes before it gets to run
+ */
+class Event : public SyncWaitable {
+public:
+        explicit Event(bool set = false) : st(set ? 1 : 0) {}
+        void Set();
+        void Reset();
+        bool IsSet() {
+                return st.load() & 1;
+        }
+        void Wait() {
+                WaitFor(0);
+        }
+        //timeoutMs == 0 waits forever, return false on timeout
+        bool WaitFor(u32 timeoutMs);
+private:
+        std::atomic<u32> st;//set in bit 0, the number of Set() above it
+};
@@ -2,9 +2,34 @@
 #include <thread>
 #include <cassert>
 #include <functional>
+#include <vector>
+#include <algorithm>
 using namespace std;
 
 #include "ThreadPoolExecutor.h"
+#include "Strand.h"
+#include "Reactor.h"
+#include "Arena.h"
+#include "PerfCounters.h"
+#include "Pipeline.h"
+#include "CpuArbiter.h"
+#include "BasicThreadPoolExecutor.h"
+#include "Executor.h"
+#include "CompletionService.h"
+#include "Parallel.h"
+#include "DurableQueue.h"
+#include "Workload.h"
+#include "Sync.h"
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <pthread.h>
+#include <cstring>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
 
 inline void sleep_sec(int sec)
 {
@@ -637,6 +662,1885 @@ void test_idle()
         delete pool;
 }
 
+void test_tenant1()
+{//a flooding tenant does not starve a light one
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        std::mutex gate;
+        std::mutex lk;
+        std::vector<int> order;
+        auto rec =
+                [&] (int who) {
+                lk.lock();
+                order.push_back(who);
+                lk.unlock();
+        };
+        gate.lock();
+        //keep the only worker busy until everything is queued
+        pool->Execute(2, [&] () {gate.lock(); gate.unlock();});
+        for (int i = 0; i < 20; i++)
+                pool->Execute(0, std::bind(rec, 0));
+        for (int i = 0; i < 5; i++)
+                pool->Execute(1, std::bind(rec, 1));
+        gate.unlock();
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(order.size() == 25);
+        //round robin: tenant 1 is done within the first 10 dispatches
+        int ones = 0;
+        for (int i = 0; i < 10; i++)
+                ones += order[i];
+        assert(ones == 5);
+        auto st = pool->GetStats();
+        assert(st.served == 26);
+        assert(st.tenants.size() == 3);
+        assert(st.tenants[0].served == 20 && st.tenants[1].served == 5);
+        delete pool;
+}
+
+void test_tenant2()
+{//weights and active caps
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        assert(pool->SetTenant(1, 0) == false);
+        assert(pool->SetTenant(1, 3, 1));
+        std::mutex lk;
+        int running = 0;
+        int peak = 0;
+        auto func =
+                [&] () {
+                lk.lock();
+                running++;
+                if (running > peak)
+                        peak = running;
+                lk.unlock();
+                const float f = 0.01;
+                sleep_sec(f);
+                lk.lock();
+                running--;
+                lk.unlock();
+        };
+        for (int i = 0; i < 8; i++)
+                pool->Execute(1, func);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(peak == 1);
+        auto st = pool->GetStats();
+        assert(st.tenants.size() == 1);
+        assert(st.tenants[0].weight == 3 && st.tenants[0].maxActive == 1);
+        assert(st.tenants[0].served == 8 && st.tenants[0].queued == 0);
+        assert(st.tenants[0].share == 1.0);
+        delete pool;
+}
+
+void test_strand1()
+{//works of one strand run in order and never overlap
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        const int S = 8;
+        const int N = 256;
+        std::vector<Strand *> strands;
+        std::vector<int> next(S, 0);
+        std::vector<int> inside(S, 0);
+        std::mutex lk;
+        bool ok = true;
+        for (int i = 0; i < S; i++)
+                strands.push_back(new Strand(pool, 4));
+        auto func =
+                [&] (int s, int seq) {
+                lk.lock();
+                if (inside[s]++ != 0 || next[s] != seq)
+                        ok = false;
+                lk.unlock();
+                std::this_thread::yield();
+                lk.lock();
+                next[s]++;
+                inside[s]--;
+                lk.unlock();
+        };
+        for (int j = 0; j < N; j++)
+                for (int i = 0; i < S; i++)
+                        assert(strands[i]->Execute(std::bind(func, i, j)));
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(ok);
+        for (int i = 0; i < S; i++) {
+                assert(next[i] == N);
+                assert(strands[i]->GetPending() == 0);
+                assert(strands[i]->Execute(std::bind(func, i, N)) == false);
+                delete strands[i];
+        }
+        delete pool;
+}
+
+void test_partition1()
+{//works of a key always run in order on the same worker
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewPartitionedThreadPool(4);
+        assert(pool->GetPoolSize() == 4);
+        assert(pool->SetMaxPoolSize(8) == false);
+        const int K = 64;
+        const int N = 64;
+        std::mutex lk;
+        std::vector<std::thread::id> owner(K);
+        std::vector<int> next(K, 0);
+        bool ok = true;
+        auto func =
+                [&] (int k, int seq) {
+                lk.lock();
+                if (seq == 0)
+                        owner[k] = std::this_thread::get_id();
+                else if (owner[k] != std::this_thread::get_id())
+                        ok = false;
+                if (next[k]++ != seq)
+                        ok = false;
+                lk.unlock();
+        };
+        for (int j = 0; j < N; j++)
+                for (int k = 0; k < K; k++)
+                        assert(pool->ExecuteByKey(k, std::bind(func, k, j)));
+        int loose = 0;
+        for (int i = 0; i < 8; i++)
+                pool->Execute([&] () {lk.lock(); loose++; lk.unlock();});
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(ok);
+        assert(loose == 8);
+        auto st = pool->GetStats();
+        assert(st.partitions.size() == 16);
+        u64 total = 0;
+        for (auto &ps : st.partitions) {
+                assert(ps.queued == 0);
+                total += ps.served;
+        }
+        assert(total == K * N + 8);
+        assert(st.rebalances == 0);
+        delete pool;
+
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        assert(pool->ExecuteByKey(1, std::bind(func, 0, 0)) == false);
+        delete pool;
+}
+
+void test_partition2()
+{//a hot partition makes its worker hand other partitions away
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewPartitionedThreadPool(2, 8);
+        assert(pool->SetRebalanceThreshold(4));
+        std::mutex lk;
+        std::vector<int> next(64, 0);
+        std::vector<int> sent(64, 0);
+        bool ok = true;
+        auto func =
+                [&] (int k, int seq) {
+                const float f = 0.001;
+                sleep_sec(f);
+                lk.lock();
+                if (next[k]++ != seq)
+                        ok = false;
+                lk.unlock();
+        };
+        //key 0 is hot, the others are spread over all partitions
+        for (int j = 0; j < 32; j++) {
+                int k = j % 63 + 1;
+                pool->ExecuteByKey(0, std::bind(func, 0, sent[0]++));
+                pool->ExecuteByKey(k, std::bind(func, k, sent[k]++));
+        }
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        auto st = pool->GetStats();
+        assert(st.rebalances > 0);
+        assert(ok);
+        assert(next == sent);
+        delete pool;
+}
+
+void test_ManagedBlock1()
+{//a blocked work gets a compensating worker, which retires afterwards
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(1);
+        std::mutex lk;
+        std::condition_variable cv;
+        bool flag = false;
+        pool->Execute([&] () {
+                        pool->ManagedBlock([&] () {
+                                        std::unique_lock<std::mutex> ul(lk);
+                                        while (!flag)
+                                                cv.wait(ul);
+                                });
+                });
+        const float f = 0.1;
+        sleep_sec(f);
+        //without compensation this one would never run
+        pool->Execute([&] () {
+                        std::lock_guard<std::mutex> lg(lk);
+                        flag = true;
+                        cv.notify_all();
+                });
+        while (1) {
+                std::lock_guard<std::mutex> lg(lk);
+                if (flag)
+                        break;
+        }
+        sleep_sec(f);
+        auto st = pool->GetStats();
+        assert(st.blocked == 0);
+        assert(st.poolSize == 1);
+        assert(st.served == 2);
+
+        //no compensation when disabled, the region is still accounted
+        assert(pool->SetCompensationLimit(0));
+        pool->Execute([&] () {
+                        pool->BeginBlocking();
+                        assert(pool->GetStats().blocked == 1);
+                        pool->Execute([] () {});
+                        assert(pool->GetPoolSize() == 1);
+                        pool->EndBlocking();
+                });
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(pool->GetStats().served == 4);
+        delete pool;
+
+        //sharded, with works put before and while it blocks
+        pool = ThreadPoolExecutor::NewShardedThreadPool(1);
+        std::atomic<int> ran(0);
+        flag = false;
+        pool->Execute([&] () {
+                        pool->Execute([&ran] () {ran++;});
+                        pool->ManagedBlock([&] () {
+                                        std::unique_lock<std::mutex> ul(lk);
+                                        while (!flag)
+                                                cv.wait(ul);
+                                });
+                });
+        for (int i = 0; i < 1000 && ran == 0; i++)
+                sleep_sec(0.001f);
+        assert(ran == 1);
+        pool->Execute([&] () {
+                        std::lock_guard<std::mutex> lg(lk);
+                        flag = true;
+                        cv.notify_all();
+                });
+        while (1) {
+                std::lock_guard<std::mutex> lg(lk);
+                if (flag)
+                        break;
+        }
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(pool->GetStats().served == 3);
+        delete pool;
+}
+
+#ifdef __linux__
+void test_reactor1()
+{//one-shot events are dispatched into the pool and re-armed by the handler
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        auto reactor = new Reactor(pool);
+        int sv[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        std::mutex lk;
+        int got = 0;
+        auto handler =
+                [&] (int fd, u32 events) {
+                assert(events & EPOLLIN);
+                char c;
+                assert(read(fd, &c, 1) == 1);
+                lk.lock();
+                got++;
+                lk.unlock();
+                reactor->Rearm(fd, EPOLLIN);
+        };
+        assert(reactor->Add(sv[0], EPOLLIN, handler));
+        assert(reactor->Add(sv[0], EPOLLIN, handler) == false);
+        const float f = 0.05;
+        for (int i = 0; i < 4; i++) {
+                assert(write(sv[1], "x", 1) == 1);
+                sleep_sec(f);
+        }
+        assert(got == 4);
+        assert(reactor->GetDispatched() == 4);
+        assert(reactor->Remove(sv[0]));
+        assert(reactor->Remove(sv[0]) == false);
+        assert(write(sv[1], "x", 1) == 1);
+        sleep_sec(f);
+        assert(got == 4);
+        reactor->Wakeup();
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete reactor;
+        delete pool;
+        close(sv[0]);
+        close(sv[1]);
+
+        //an event an overloaded pool lets go arms its fd again, a throwing
+        //handler returns its registration
+        pool = ThreadPoolExecutor::NewFixedThreadPool(1);
+        ThreadPoolExecutor::AdmissionConfig cfg;
+        cfg.targetUs = 1000;
+        cfg.intervalMs = 10;
+        std::atomic<int> let(0);
+        cfg.onReject = [&let] (const std::function<void()> &) {let++;};
+        assert(pool->SetAdmissionControl(cfg));
+        assert(pool->Execute([] () {sleep_sec(0.05f);}));
+        for (int i = 0; i < 100; i++)
+                assert(pool->Execute([] () {sleep_sec(0.002f);}));
+        for (int i = 0; i < 1000 && !pool->GetStats().admission.overloaded; i++)
+                sleep_sec(0.001f);
+        assert(pool->GetStats().admission.overloaded);
+        reactor = new Reactor(pool);
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        std::atomic<int> ran(0);
+        assert(reactor->Add(sv[0], EPOLLIN, [&ran] (int fd, u32) {
+                                char c;
+                                assert(read(fd, &c, 1) == 1);
+                                ran++;
+                                throw std::runtime_error("reactor");
+                        }));
+        assert(write(sv[1], "x", 1) == 1);
+        for (int i = 0; i < 5000 && ran == 0; i++)
+                sleep_sec(0.001f);
+        assert(ran == 1 && let > 0);
+        assert(reactor->Remove(sv[0]));
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(pool->GetStats().failed == 1);
+        delete reactor;
+        delete pool;
+        close(sv[0]);
+        close(sv[1]);
+}
+#endif
+
+void test_trace1()
+{//trace events end up in a Chrome trace JSON file
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        const char *path = "trace_test.json";
+        assert(pool->FlushTrace(path) == false);
+        pool->Execute([] () {}, "untraced");
+        while (pool->GetStats().served == 0 || pool->GetActiveCount() != 0)
+                std::this_thread::yield();
+        assert(pool->EnableTracing(64));
+        for (int i = 0; i < 8; i++)
+                pool->Execute([] () {}, "traced_\"work");
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        pool->DisableTracing();
+        assert(pool->FlushTrace(path));
+        std::ifstream in(path);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        std::string js = ss.str();
+        assert(js.find("\"traceEvents\"") != std::string::npos);
+        assert(js.find("untraced") == std::string::npos);
+        assert(js.find("traced_\\\"work") != std::string::npos);
+        assert(js.find("\"ph\":\"B\"") != std::string::npos);
+        assert(js.find("\"ph\":\"E\"") != std::string::npos);
+        assert(js.find("\"cat\":\"exit\"") != std::string::npos);
+        remove(path);
+        delete pool;
+}
+
+void test_perf1()
+{//counters are summed per work name, or stay 0 where perf is not permitted
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        assert(pool->EnablePerfCounters());
+        volatile u64 sink = 0;
+        auto spin =
+                [&] () {
+                for (int i = 0; i < 100000; i++)
+                        sink += i;
+        };
+        for (int i = 0; i < 8; i++)
+                pool->Execute(spin, "spin");
+        pool->Execute([] () {});
+        for (int i = 0; i < 4; i++)
+                pool->Execute([] () {sleep_sec(0.001f);}, "sleep");
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        auto st = pool->GetStats();
+        assert(st.perf.size() == 3);
+        assert(strcmp(st.perf[0].name, "") == 0 && st.perf[0].works == 1);
+        assert(strcmp(st.perf[1].name, "sleep") == 0 && st.perf[1].works == 4);
+        assert(strcmp(st.perf[2].name, "spin") == 0 && st.perf[2].works == 8);
+        cout << "perf available: " << st.perfAvailable
+             << " instructions: " << st.perf[2].instructions
+             << " context switches: " << st.perf[1].ctxSwitches << endl;
+        if (!st.perfAvailable)
+                assert(st.perf[2].instructions == 0 && st.perf[2].cycles == 0);
+        //workers get the same permissions as this thread, a sleep switches
+        //context wherever the counter is open
+        PerfCounters probe;
+        u64 v0[PerfCounters::COUNT], v1[PerfCounters::COUNT];
+        probe.Open();
+        probe.Read(v0);
+        sleep_sec(0.001f);
+        probe.Read(v1);
+        if (v1[PerfCounters::CTX_SWITCHES] > v0[PerfCounters::CTX_SWITCHES])
+                assert(st.perf[1].ctxSwitches >= 4);
+        delete pool;
+}
+
+void test_watchdog1()
+{//a runaway work is reported and compensated, the queue behind it too
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(1);
+        std::mutex lk;
+        std::vector<ThreadPoolExecutor::StallInfo> seen;
+        ThreadPoolExecutor::WatchdogConfig cfg;
+        cfg.intervalMs = 10;
+        cfg.runMs = 50;
+        cfg.queueMs = 30;
+        cfg.compensate = true;
+        cfg.onStall =
+                [&] (const ThreadPoolExecutor::StallInfo &si) {
+                lk.lock();
+                seen.push_back(si);
+                lk.unlock();
+        };
+        assert(pool->EnableWatchdog(cfg));
+        bool quick = false;
+        bool quick_first = false;
+        pool->Execute([&] () {
+                        const float f = 0.4;
+                        sleep_sec(f);
+                        lk.lock();
+                        quick_first = quick;
+                        lk.unlock();
+                }, "slow");
+        pool->Execute([&] () {lk.lock(); quick = true; lk.unlock();}, "quick");
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        //the compensating worker ran the quick work while slow was stuck
+        assert(quick_first);
+        bool run = false, queue = false;
+        for (auto &si : seen) {
+                if (si.worker == 0xffffffff) {
+                        queue = true;
+                } else {
+                        assert(strcmp(si.name, "slow") == 0);
+                        assert(si.elapsedMs >= 50);
+                        run = true;
+                }
+        }
+        assert(run && queue);
+        assert(pool->GetStats().stalls == seen.size());
+        assert(pool->GetStats().blocked == 0);
+        delete pool;
+
+        //works ending right when they are found stalled leave nothing blocked
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        cfg.intervalMs = 1;
+        cfg.runMs = 2;
+        cfg.queueMs = 0;
+        cfg.onStall = nullptr;
+        assert(pool->EnableWatchdog(cfg));
+        for (int i = 0; i < 200; i++)
+                pool->Execute([] () {sleep_sec(0.002f);});
+        while (pool->GetStats().served < 200 || pool->GetActiveCount() != 0)
+                sleep_sec(0.01f);
+        auto st = pool->GetStats();
+        assert(st.stalls > 0 && st.blocked == 0);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+}
+
+void test_attributes1()
+{//workers are created with the requested stack, name and hooks
+        cout << "============================ " << __func__ << " ==============" << endl;
+        std::mutex lk;
+        int started = 0;
+        int exited = 0;
+        ThreadAttributes attr;
+        attr.stackSize = 64 * 1024;
+        attr.name = "tpe-worker";
+        attr.onStart = [&] () {lk.lock(); started++; lk.unlock();};
+        attr.onExit = [&] () {lk.lock(); exited++; lk.unlock();};
+        auto pool = ThreadPoolExecutor::NewCachedThreadPool(attr);
+        bool ok = true;
+        for (int i = 0; i < 64; i++)
+                pool->Execute([&] () {
+                                char buf[64];
+                                //works still have room for their frames
+                                memset(buf, 0, sizeof(buf));
+#ifdef __linux__
+                                pthread_attr_t pa;
+                                size_t sz = 0;
+                                pthread_getattr_np(pthread_self(), &pa);
+                                pthread_attr_getstacksize(&pa, &sz);
+                                pthread_attr_destroy(&pa);
+                                char name[16];
+                                pthread_getname_np(pthread_self(), name, sizeof(name));
+                                lk.lock();
+                                if (sz > 256 * 1024 || strncmp(name, "tpe-worker-", 11) != 0)
+                                        ok = false;
+                                lk.unlock();
+#endif
+                                const float f = 0.05;
+                                sleep_sec(f);
+                        });
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+        //exit hooks run after the workers left the pool
+        for (int i = 0; i < 100; i++) {
+                lk.lock();
+                bool done = (exited == started);
+                lk.unlock();
+                if (done)
+                        break;
+                const float f = 0.01;
+                sleep_sec(f);
+        }
+        assert(ok);
+        assert(started > 0 && exited == started);
+}
+
+void test_arena1()
+{//every work gets a fresh scratch arena of its worker
+        cout << "============================ " << __func__ << " ==============" << endl;
+        assert(ThreadPoolExecutor::CurrentArena() == nullptr);
+        std::vector<int, ArenaAllocator<int> > outside;
+        for (int i = 0; i < 100; i++)
+                outside.push_back(i);
+        assert(outside.get_allocator().arena == nullptr);
+
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        std::mutex lk;
+        bool ok = true;
+        for (int n = 0; n < 16; n++)
+                pool->Execute([&] () {
+                                Arena *a = ThreadPoolExecutor::CurrentArena();
+                                bool good = a != nullptr && a->GetUsed() == 0
+                                        && a->GetOverflows() == 0;
+                                {
+                                        //outgrows the 64K chunk
+                                        std::vector<int, ArenaAllocator<int> > v;
+                                        for (int i = 0; i < 64 * 1024; i++)
+                                                v.push_back(i);
+                                        for (int i = 0; i < 64 * 1024; i++)
+                                                good = good && v[i] == i;
+                                }
+                                good = good && a->GetUsed() > 0 && a->GetOverflows() > 0;
+                                void *p = a->Allocate(3, 64);
+                                good = good && ((size_t)p & 63) == 0;
+                                lk.lock();
+                                ok = ok && good;
+                                lk.unlock();
+                        });
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(ok);
+        delete pool;
+
+        ThreadAttributes attr;
+        attr.arenaSize = 0;
+        pool = ThreadPoolExecutor::NewFixedThreadPool(1, attr);
+        pool->Execute([&] () {ok = ThreadPoolExecutor::CurrentArena() == nullptr;});
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(ok);
+        delete pool;
+}
+
+void test_batch1()
+{//a deep queue is taken in batches, order and accounting are kept
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        assert(pool->SetMaxBatch(0) == false);
+        assert(pool->SetMaxBatch(8));
+        std::mutex gate;
+        std::vector<int> order;
+        gate.lock();
+        pool->Execute([&] () {gate.lock(); gate.unlock();});
+        for (int i = 0; i < 100; i++)
+                pool->Execute([&order, i] () {order.push_back(i);});
+        gate.unlock();
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(order.size() == 100);
+        for (int i = 0; i < 100; i++)
+                assert(order[i] == i);
+        auto st = pool->GetStats();
+        assert(st.served == 101 && st.activeCount == 0);
+        assert(st.batches < 101 && st.batches >= 101 / 8);
+        delete pool;
+
+        //no batching
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        pool->SetMaxBatch(1);
+        for (int i = 0; i < 100; i++)
+                pool->Execute([] () {});
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        st = pool->GetStats();
+        assert(st.served == 100 && st.batches == 100);
+        delete pool;
+}
+
+void test_lifo1()
+{//the last idle worker takes the next work, the others are reaped
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = new ThreadPoolExecutor(0, 4, 1);
+        std::mutex lk;
+        std::vector<std::thread::id> ids;
+        auto who =
+                [&] () {
+                lk.lock();
+                ids.push_back(std::this_thread::get_id());
+                lk.unlock();
+        };
+        //grow to 4 workers
+        for (int i = 0; i < 4; i++)
+                pool->Execute([] () {sleep_sec(0.2f);});
+        sleep_sec(0.4f);
+        assert(pool->GetPoolSize() == 4);
+        //one work at a time, every worker is parked when it comes
+        for (int i = 0; i < 30; i++) {
+                pool->Execute(who);
+                sleep_sec(0.05f);
+        }
+        for (auto &id : ids)
+                assert(id == ids[0]);
+        //the cold ones timed out meanwhile
+        assert(pool->GetPoolSize() == 1);
+        delete pool;
+
+        //the old rotation
+        pool = new ThreadPoolExecutor(0, 4, 1);
+        assert(pool->SetLifoWakeup(false));
+        ids.clear();
+        for (int i = 0; i < 4; i++)
+                pool->Execute([] () {sleep_sec(0.2f);});
+        sleep_sec(0.4f);
+        for (int i = 0; i < 8; i++) {
+                pool->Execute(who);
+                sleep_sec(0.05f);
+        }
+        std::sort(ids.begin(), ids.end());
+        assert(std::unique(ids.begin(), ids.end()) - ids.begin() == 4);
+        pool->Shutdown(false);
+        assert(pool->SetLifoWakeup(true) == false);
+        delete pool;
+}
+
+void test_spin1()
+{//spinning and hot workers still run every work and quit on shutdown
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        assert(pool->SetSpinWait(200, 1));
+        std::atomic<int> done(0);
+        for (int i = 0; i < 200; i++) {
+                pool->Execute([&done] () {done++;});
+                if (i % 10 == 0)
+                        std::this_thread::sleep_for(std::chrono::microseconds(300));
+                if (i == 100)
+                        assert(pool->SetSpinWait(50, 0));//retune while running
+        }
+        assert(pool->SetSpinWait(1000, 2));
+        sleep_sec(0.1f);
+        for (int i = 0; i < 200; i++)
+                pool->Execute([&done] () {done++;});
+        pool->Shutdown(false);
+        assert(pool->SetSpinWait(0, 0) == false);
+        assert(pool->AwaitTermination(5));
+        assert(done == 400);
+        delete pool;
+
+        //partition workers spin on their own semaphores
+        pool = ThreadPoolExecutor::NewPartitionedThreadPool(2);
+        assert(pool->SetSpinWait(100, 1));
+        for (u64 k = 0; k < 100; k++)
+                pool->ExecuteByKey(k, [&done] () {done++;});
+        pool->Shutdown(false);
+        assert(pool->AwaitTermination(5));
+        assert(done == 500);
+        delete pool;
+}
+
+void test_pipeline1()
+{//in order output, serial stages never overlap, tokens bound the flight
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        Pipeline pl(pool, 8);
+        int next = 0;
+        std::atomic<int> inside(0);
+        std::vector<int> out;
+        pl.AddStage(Pipeline::SERIAL_IN_ORDER, [&] (void *) -> void * {
+                        if (next == 1000)
+                                return nullptr;
+                        return new int(next++);
+                });
+        pl.AddStage(Pipeline::PARALLEL, [] (void *p) -> void * {
+                        int *v = (int *)p;
+                        if (*v % 10 == 9) {
+                                delete v;
+                                return nullptr;//dropped
+                        }
+                        if (*v % 7 == 0)
+                                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        return v;
+                });
+        pl.AddStage(Pipeline::SERIAL_OUT_OF_ORDER, [&] (void *p) -> void * {
+                        assert(++inside == 1);
+                        std::this_thread::yield();
+                        inside--;
+                        return p;
+                });
+        pl.AddStage(Pipeline::SERIAL_IN_ORDER, [&] (void *p) -> void * {
+                        int *v = (int *)p;
+                        out.push_back(*v);
+                        delete v;
+                        return nullptr;
+                });
+        for (int round = 0; round < 2; round++) {
+                next = 0;
+                out.clear();
+                assert(pl.Run() == 1000);
+                assert(out.size() == 900);
+                for (size_t i = 1; i < out.size(); i++)
+                        assert(out[i - 1] < out[i]);
+                assert(pl.GetPeakTokens() <= 8 && pl.GetPeakTokens() > 1);
+        }
+
+        //a throwing filter frees its token and stage and ends the input
+        Pipeline pt(pool, 4);
+        int in = 0, bad = 50;
+        std::atomic<int> left(0);
+        pt.AddStage(Pipeline::SERIAL_IN_ORDER, [&] (void *) -> void * {
+                        if (in == 1000)
+                                return nullptr;
+                        if (in == bad + 500)
+                                throw std::runtime_error("input");
+                        return new int(in++);
+                });
+        pt.AddStage(Pipeline::SERIAL_OUT_OF_ORDER, [&] (void *p) -> void * {
+                        int *v = (int *)p;
+                        if (*v == bad) {
+                                delete v;
+                                throw std::runtime_error("stage");
+                        }
+                        return v;
+                });
+        pt.AddStage(Pipeline::PARALLEL, [&] (void *p) -> void * {
+                        delete (int *)p;
+                        left++;
+                        return nullptr;
+                });
+        std::string what;
+        try {
+                pt.Run();
+        } catch (const std::runtime_error &e) {
+                what = e.what();
+        }
+        assert(what == "stage" && in < 1000 && left == in - 1);
+        //the next run starts clean, this time the input fails
+        in = 0;
+        left = 0;
+        bad = -1;
+        what.clear();
+        try {
+                pt.Run();
+        } catch (const std::runtime_error &e) {
+                what = e.what();
+        }
+        assert(what == "input" && left == 499);
+        bad = 1000;
+        in = 0;
+        left = 0;
+        assert(pt.Run() == 1000 && left == 1000);
+        delete pool;
+}
+
+void test_arbiter1()
+{//two pools never run more works than the budget, an idle one lends
+        cout << "============================ " << __func__ << " ==============" << endl;
+        CpuArbiter arb(2);
+        auto pa = ThreadPoolExecutor::NewFixedThreadPool(4);
+        auto pb = ThreadPoolExecutor::NewFixedThreadPool(4);
+        assert(pa->SetCpuArbiter(&arb, 1));
+        assert(pb->SetCpuArbiter(&arb, 1));
+        assert(pb->SetCpuArbiter(&arb, 3));//new weight
+        CpuArbiter other(1);
+        assert(pb->SetCpuArbiter(&other) == false);
+        std::atomic<int> running(0), most(0);
+        auto work =
+                [&] () {
+                int r = ++running;
+                for (int m = most; r > m && !most.compare_exchange_weak(m, r);)
+                        ;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                running--;
+        };
+        //only pa busy, it gets the whole budget
+        for (int i = 0; i < 20; i++)
+                pa->Execute(work);
+        while (pa->GetStats().served < 20 || pa->GetActiveCount() != 0)
+                sleep_sec(0.01f);
+        assert(most == 2);
+        //both busy
+        most = 0;
+        for (int i = 0; i < 20; i++) {
+                pa->Execute(work);
+                pb->Execute(work);
+        }
+        while (pa->GetStats().served < 40 || pb->GetStats().served < 20
+               || pa->GetActiveCount() + pb->GetActiveCount() != 0)
+                sleep_sec(0.01f);
+        assert(most <= 2);
+        auto st = arb.GetStats();
+        assert(st.size() == 2);
+        for (auto &ps : st) {
+                assert(ps.held == 0 && ps.waiting == 0);
+                assert(ps.weight == (ps.pool == pa ? 1u : 3u));
+        }
+        //a blocked work hands its permit over
+        arb.SetBudget(1);
+        bool quick = false;
+        pa->Execute([&] () {
+                        pa->ManagedBlock([&] () {sleep_sec(0.3f);});
+                        assert(quick);
+                });
+        sleep_sec(0.05f);
+        pb->Execute([&] () {quick = true;});
+        delete pa;
+        delete pb;
+        assert(arb.GetStats().empty());
+
+        //a cached pool does not grow for workers waiting on a permit
+        auto hog = ThreadPoolExecutor::NewFixedThreadPool(1);
+        auto pc = ThreadPoolExecutor::NewCachedThreadPool();
+        assert(hog->SetCpuArbiter(&arb));
+        assert(pc->SetCpuArbiter(&arb));
+        hog->Execute([] () {sleep_sec(0.2f);});
+        auto held = [&arb] () {
+                u32 n = 0;
+                for (auto &ps : arb.GetStats())
+                        n += ps.held;
+                return n;
+        };
+        while (held() == 0)
+                sleep_sec(0.001f);
+        std::atomic<int> ran(0);
+        for (int i = 0; i < 50; i++) {
+                pc->Execute([&ran] () {ran++;});
+                sleep_sec(0.001f);
+        }
+        assert(ran == 0 && pc->GetPoolSize() <= 2);
+        while (ran < 50)
+                sleep_sec(0.001f);
+        delete pc;
+        delete hog;
+}
+
+template<class Pool>
+void basic_run(Pool *pool, std::atomic<int> &cnt)
+{
+        for (int i = 0; i < 10000; i++)
+                assert(pool->Execute([&cnt] () {cnt++;}));
+        pool->Shutdown(false);
+        assert(pool->Execute([] () {}) == false);
+        assert(pool->AwaitTermination(10));
+        assert(cnt == 10000);
+        delete pool;
+}
+
+void test_basic1()
+{//every policy combination runs all works and quits
+        cout << "============================ " << __func__ << " ==============" << endl;
+        typedef BasicThreadPoolExecutor<MutexQueue, ParkWait, FixedSizing> P1;
+        typedef BasicThreadPoolExecutor<LockFreeQueue, ParkWait, FixedSizing> P2;
+        typedef BasicThreadPoolExecutor<LockFreeQueue, SpinWait, FixedSizing> P3;
+        typedef BasicThreadPoolExecutor<MutexQueue, ParkWait, DynamicSizing> P4;
+        typedef BasicThreadPoolExecutor<MutexQueue, SpinWait, DynamicSizing> P5;
+        std::atomic<int> c1(0), c2(0), c3(0), c4(0), c5(0);
+        basic_run(new P1(4), c1);
+        basic_run(new P2(4, 16384), c2);
+        basic_run(new P3(2), c3);
+        basic_run(new P4(DynamicSizing::Config(0, 4, 1)), c4);
+        basic_run(new P5(DynamicSizing::Config(1, 2, 1)), c5);
+
+        //a bounded queue refuses works when full
+        auto p = new P2(1, 4);
+        std::mutex gate;
+        gate.lock();
+        assert(p->Execute([&] () {gate.lock(); gate.unlock();}));
+        sleep_sec(0.1f);
+        int in = 0;
+        while (p->Execute([] () {}))
+                in++;
+        assert(in == 4);
+        gate.unlock();
+        delete p;
+
+        //dynamic: grows up to max when busy, shrinks back after keep alive
+        auto d = new P4(DynamicSizing::Config(1, 3, 1));
+        assert(d->GetPoolSize() == 1);
+        for (int i = 0; i < 6; i++)
+                d->Execute([] () {sleep_sec(0.2f);});
+        assert(d->GetPoolSize() == 3);
+        sleep_sec(2.0f);
+        assert(d->GetPoolSize() == 1);
+        //asap drops what is queued
+        std::atomic<int> ran(0);
+        for (int i = 0; i < 10; i++)
+                d->Execute([&ran] () {sleep_sec(0.1f); ran++;});
+        sleep_sec(0.05f);
+        d->Shutdown(true);
+        assert(d->AwaitTermination(5));
+        assert(ran < 10);
+        delete d;
+
+        //a work accepted while the pool quits still runs
+        for (int round = 0; round < 50; round++) {
+                auto f = new P3(2);
+                std::atomic<int> took(0), done(0);
+                std::thread producer([f, &took, &done] () {
+                                while (f->Execute([&done] () {done++;}))
+                                        took++;
+                        });
+                sleep_sec(0.001f);
+                f->Shutdown(false);
+                producer.join();
+                assert(f->AwaitTermination(5));
+                assert(done == took);
+                delete f;
+        }
+        //and it is an Executor
+        P1 e(2);
+        Executor *ex = &e;
+        auto fut = ex->Submit([] () {return 7;});
+        assert(fut.get() == 7);
+
+        //a throwing work takes neither its worker nor the process
+        auto t = new P4(DynamicSizing::Config(1, 1, 1));
+        std::atomic<int> after(0);
+        for (int i = 0; i < 10; i++) {
+                t->Execute([] () {throw std::runtime_error("basic");});
+                t->Execute([&after] () {after++;});
+        }
+        t->Shutdown(false);
+        assert(t->AwaitTermination(5));
+        assert(after == 10 && t->GetFailed() == 10);
+        delete t;
+}
+
+//any engine through the interface
+static int executor_sum(Executor *ex)
+{
+        std::vector<std::future<int> > fs;
+        for (int i = 0; i < 100; i++)
+                fs.push_back(ex->Submit([i] () {return i;}));
+        int sum = 0;
+        for (auto &f : fs)
+                sum += f.get();
+        return sum;
+}
+
+//the same through the concept, bound at compile time
+template<class Ex>
+static int executor_sum_t(Ex &ex)
+{
+        std::vector<std::future<int> > fs;
+        for (int i = 0; i < 100; i++)
+                fs.push_back(Submit(ex, [i] () {return i;}));
+        int sum = 0;
+        for (auto &f : fs)
+                sum += f.get();
+        return sum;
+}
+
+void test_executor1()
+{//every engine runs submitted works, serial ones in order
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        InlineExecutor inl;
+        ThreadPerTaskExecutor tpt;
+        SerialExecutor ser(pool);
+        SerialExecutor ser_inl(&inl);
+        Strand strand(pool);
+        Executor *all[] = {pool, &inl, &tpt, &ser, &ser_inl, &strand};
+        for (auto ex : all)
+                assert(executor_sum(ex) == 4950);
+        assert(executor_sum_t(*pool) == 4950);
+        assert(executor_sum_t(inl) == 4950);
+
+        //inline runs on the caller
+        auto me = std::this_thread::get_id();
+        assert(inl.Submit([] () {return std::this_thread::get_id();}).get() == me);
+        //exceptions travel through the future
+        auto fe = tpt.Submit([] () -> int {throw std::runtime_error("x");});
+        bool thrown = false;
+        try {
+                fe.get();
+        } catch (const std::runtime_error &) {
+                thrown = true;
+        }
+        assert(thrown);
+
+        //serial executor never overlaps and keeps the order
+        std::vector<int> order;
+        std::atomic<int> inside(0);
+        for (int i = 0; i < 200; i++)
+                ser.Execute([&, i] () {
+                                assert(++inside == 1);
+                                order.push_back(i);
+                                inside--;
+                        });
+        ser.Submit([] () {return 0;}).get();
+        assert(order.size() == 200);
+        for (int i = 0; i < 200; i++)
+                assert(order[i] == i);
+
+        //refused works leave a broken promise
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        auto fr = pool->Submit([] () {return 1;});
+        thrown = false;
+        try {
+                fr.get();
+        } catch (const std::future_error &e) {
+                thrown = e.code() == std::future_errc::broken_promise;
+        }
+        assert(thrown);
+        assert(ser.Execute([] () {}) == false && ser.GetPending() == 0);
+        delete pool;
+
+        //a thread whose work throws still counts itself out
+        {
+                ThreadPerTaskExecutor tpt2;
+                assert(tpt2.Execute([] () {throw std::runtime_error("x");}));
+        }
+
+        //a turn dropped unrun takes its works along and ends the turn
+        struct Holder : Executor {
+                std::vector<std::function<void()> > q;
+                bool Execute(const std::function<void()> &task) override {
+                        q.push_back(task);
+                        return true;
+                }
+        } hold;
+        SerialExecutor ser_hold(&hold);
+        int ran = 0;
+        assert(ser_hold.Execute([&ran] () {ran++;}));
+        assert(ser_hold.Execute([&ran] () {ran++;}));
+        assert(hold.q.size() == 1 && ser_hold.GetPending() == 2);
+        hold.q.clear();
+        assert(ser_hold.GetPending() == 0);
+        assert(ser_hold.Execute([&ran] () {ran += 10;}));
+        assert(hold.q.size() == 1);
+        hold.q[0]();
+        assert(ran == 10 && ser_hold.GetPending() == 0);
+}
+
+void test_shard1()
+{//many producers on a sharded pool, no work lost and no wakeup missed
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewShardedThreadPool(4, 2);
+        assert(pool->GetPoolSize() == 4);
+        const int P = 8;
+        const int N = 2000;
+        std::atomic<int> cnt(0);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < P; p++)
+                producers.emplace_back([&] () {
+                                for (int i = 0; i < N; i++)
+                                        assert(pool->Execute([&cnt] () {cnt++;}));
+                        });
+        for (auto &th : producers)
+                th.join();
+        //one work at a time into an idle pool, every one must wake a worker
+        for (int i = 0; i < 50; i++) {
+                std::atomic<bool> done(false);
+                pool->Execute([&done] () {done = true;});
+                for (int j = 0; j < 1000 && !done; j++)
+                        sleep_sec(0.001f);
+                assert(done);
+        }
+        std::vector<std::function<void()> > works(100, [&cnt] () {cnt++;});
+        assert(pool->ExecuteBatch(works));
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(pool->Execute([] () {}) == false);
+        assert(cnt == P * N + 100);
+        auto st = pool->GetStats();
+        assert(st.queued == 0);
+        assert(st.served == (u64)P * N + 100 + 50);
+        assert(st.activeCount == 0);
+        delete pool;
+}
+
+void test_admission1()
+{//a standing queue makes the pool refuse or divert new works until it drains
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(1);
+        ThreadPoolExecutor::AdmissionConfig cfg;
+        cfg.targetUs = 1000;
+        cfg.intervalMs = 10;
+        assert(pool->SetAdmissionControl(cfg));
+        std::atomic<int> ran(0);
+        std::atomic<int> diverted(0);
+        for (int round = 0; round < 2; round++) {
+                if (round == 1) {
+                        cfg.onReject = [&diverted] (const std::function<void()> &) {diverted++;};
+                        assert(pool->SetAdmissionControl(cfg));
+                }
+                //a slow work then a queue that stays put for a while
+                assert(pool->Execute([] () {sleep_sec(0.1f);}));
+                for (int i = 0; i < 20; i++)
+                        assert(pool->Execute([&ran] () {sleep_sec(0.005f); ran++;}));
+                for (int i = 0; i < 1000 && !pool->GetStats().admission.overloaded; i++)
+                        sleep_sec(0.001f);
+                auto st = pool->GetStats();
+                assert(st.admission.enabled && st.admission.overloaded);
+                assert(st.admission.minSojournUs >= 1000);
+                assert(st.admission.overloads == (u64)round + 1);
+                bool taken = pool->Execute([&ran] () {ran++;});
+                assert(taken == (round == 1));
+                //an idle worker ends the overload
+                for (int i = 0; i < 1000 && pool->GetStats().admission.overloaded; i++)
+                        sleep_sec(0.001f);
+                assert(!pool->GetStats().admission.overloaded);
+                assert(ran == 20 * (round + 1));
+        }
+        auto st = pool->GetStats();
+        assert(st.admission.rejected == 1);
+        assert(st.admission.diverted == 1 && diverted == 1);
+        cfg.targetUs = 0;
+        assert(pool->SetAdmissionControl(cfg));
+        assert(pool->GetStats().admission.enabled == false);
+        assert(pool->Execute([&ran] () {ran++;}));
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(ran == 41);
+        delete pool;
+}
+
+void test_shed1()
+{//strands and pipelines keep going when the pool diverts their works
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(1);
+        ThreadPoolExecutor::AdmissionConfig cfg;
+        cfg.targetUs = 1000;
+        cfg.intervalMs = 10;
+        std::atomic<int> diverted(0);
+        //run on the spot, strands used to deadlock on their own lock here
+        cfg.onReject = [&diverted] (const std::function<void()> &t) {diverted++; t();};
+        assert(pool->SetAdmissionControl(cfg));
+        auto overload = [pool] () {
+                assert(pool->Execute([] () {sleep_sec(0.05f);}));
+                for (int i = 0; i < 100; i++)
+                        assert(pool->Execute([] () {sleep_sec(0.005f);}));
+                for (int i = 0; i < 1000 && !pool->GetStats().admission.overloaded; i++)
+                        sleep_sec(0.001f);
+                assert(pool->GetStats().admission.overloaded);
+        };
+        overload();
+        Strand strand(pool, 4);
+        std::vector<int> order;
+        for (int i = 0; i < 1000; i++)
+                assert(strand.Execute([&order, i] () {order.push_back(i);}));
+        //every piece runs in place, that must not nest item after item
+        Pipeline pl(pool, 4);
+        int next = 0, last = -1;
+        bool sorted = true;
+        pl.AddStage(Pipeline::SERIAL_IN_ORDER, [&next] (void *) -> void * {
+                        return next < 100000 ? (void *)(intptr_t)++next : nullptr;
+                });
+        pl.AddStage(Pipeline::PARALLEL, [] (void *p) -> void * {return p;});
+        pl.AddStage(Pipeline::SERIAL_IN_ORDER, [&last, &sorted] (void *p) -> void * {
+                        int v = (int)(intptr_t)p;
+                        sorted = sorted && v == last + 1;
+                        last = v;
+                        return nullptr;
+                });
+        last = 0;
+        assert(pl.Run() == 100000);
+        assert(sorted && last == 100000);
+        while (strand.GetPending() != 0)
+                sleep_sec(0.001f);
+        Latch drained(1);
+        assert(strand.Execute([&drained] () {drained.CountDown();}));
+        drained.Wait();
+        assert(order.size() == 1000 && std::is_sorted(order.begin(), order.end()));
+        assert(diverted > 0);
+
+        //a dropped turn drops what is pending, the strand goes on
+        cfg.onReject = [&diverted] (const std::function<void()> &) {diverted++;};
+        assert(pool->SetAdmissionControl(cfg));
+        overload();
+        std::atomic<int> ran(0);
+        for (int i = 0; i < 10; i++)
+                assert(strand.Execute([&ran] () {ran++;}));
+        while (pool->GetStats().admission.overloaded)
+                sleep_sec(0.001f);
+        Latch after(1);
+        assert(strand.Execute([&after] () {after.CountDown();}));
+        after.Wait();
+        assert(ran <= 10);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+}
+
+void test_parallel1()
+{//sort and scans against the serial std algorithms
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(4);
+        const size_t sizes[] = {0, 1, 1000, 100000, 1000003};
+        u32 seed = 1;
+        auto rnd = [&seed] () {seed = seed * 1103515245 + 12345; return (seed >> 8) % 100000;};
+        for (auto n : sizes) {
+                std::vector<int> v(n);
+                for (auto &x : v)
+                        x = rnd();
+                std::vector<int> ref(v);
+                std::sort(ref.begin(), ref.end());
+                std::vector<int> got(v);
+                ParallelSort(pool, got.begin(), got.end());
+                assert(got == ref);
+                //many equal keys and a comparator
+                for (auto &x : got)
+                        x %= 7;
+                ref = got;
+                std::sort(ref.begin(), ref.end(), std::greater<int>());
+                ParallelSort(pool, got.data(), got.data() + n, std::greater<int>());
+                assert(got == ref);
+
+                std::vector<long long> in(v.begin(), v.end()), sref(n), sgot(n);
+                std::partial_sum(in.begin(), in.end(), sref.begin());
+                assert(ParallelInclusiveScan(pool, in.begin(), in.end(), sgot.begin()) == sgot.end());
+                assert(sgot == sref);
+                //exclusive, in place, from 5
+                long long acc = 5;
+                for (size_t i = 0; i < n; i++) {
+                        sref[i] = acc;
+                        acc += in[i];
+                }
+                ParallelExclusiveScan(pool, in.begin(), in.end(), in.begin(), 5LL);
+                assert(in == sref);
+        }
+        //from a worker of a single thread pool, the caller does it all
+        auto single = ThreadPoolExecutor::NewSingleThreadExecutor();
+        std::vector<int> v(300000);
+        for (auto &x : v)
+                x = rnd();
+        std::atomic<bool> done(false);
+        single->Execute([&] () {
+                        ParallelSort(single, v.begin(), v.end());
+                        done = true;
+                });
+        single->Shutdown(false);
+        single->AwaitTermination(0);
+        assert(done && std::is_sorted(v.begin(), v.end()));
+        delete single;
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+}
+
+void test_durable1()
+{//entries run once, those dropped by Shutdown(true) come back on the next Start()
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const char *path = "/tmp/test_durable1.log";
+        unlink(path);
+        std::atomic<u64> sum(0);
+        auto add = [&sum] (const char *data, u32 len) {
+                u32 v;
+                assert(len == sizeof(v));
+                memcpy(&v, data, len);
+                sum += v;
+        };
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        auto q = new DurableQueue(pool, path, 1 << 20);
+        assert(q->Put(1, "x") == false);//not started
+        assert(q->Register(1, add));
+        assert(q->Start());
+        assert(q->Register(2, add) == false);
+        for (u32 i = 1; i <= 1000; i++)
+                assert(q->Put(1, &i, sizeof(i)));
+        assert(q->Put(2, "x") == false);//no handler
+        q->Flush();
+        delete q;
+        assert(sum == 500500);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+
+        //a blocked pool dropping everything, the log keeps the entries
+        pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        std::mutex gate;
+        gate.lock();
+        pool->Execute([&gate] () {gate.lock(); gate.unlock();});
+        q = new DurableQueue(pool, path);
+        q->Register(1, add);
+        assert(q->Start());
+        assert(q->GetStats().replayed == 0);
+        for (u32 i = 1; i <= 100; i++)
+                assert(q->Put(1, &i, sizeof(i)));
+        assert(q->GetStats().pending == 100);
+        pool->Shutdown(true);
+        gate.unlock();
+        pool->AwaitTermination(0);
+        //dropped works go with the pool
+        delete pool;
+        delete q;
+        assert(sum == 500500);
+
+        sum = 0;
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        q = new DurableQueue(pool, path);
+        q->Register(1, add);
+        assert(q->Start());
+        assert(q->GetStats().replayed == 100);
+        delete q;
+        assert(sum == 5050);
+        //all acknowledged now
+        q = new DurableQueue(pool, path);
+        q->Register(1, add);
+        assert(q->Start());
+        assert(q->GetStats().replayed == 0);
+        delete q;
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+        unlink(path);
+}
+
+void test_durable2()
+{//a small log wraps around, refuses puts when full and replays across the wrap
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const char *path = "/tmp/test_durable2.log";
+        unlink(path);
+        std::atomic<int> ran(0);
+        std::string big(200, 'b');
+        auto check = [&ran, &big] (const char *data, u32 len) {
+                assert(std::string(data, len) == big);
+                ran++;
+        };
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        auto q = new DurableQueue(pool, path, 4096 * 2);
+        q->Register(1, check);
+        assert(q->Start());
+        //many laps over the log
+        for (int i = 0; i < 1000; i++)
+                while (!q->Put(1, big))
+                        std::this_thread::yield();
+        delete q;
+        assert(ran == 1000);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+
+        pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        std::mutex gate;
+        gate.lock();
+        pool->Execute([&gate] () {gate.lock(); gate.unlock();});
+        q = new DurableQueue(pool, path);
+        q->Register(1, [] (const char *, u32) {});
+        assert(q->Start());
+        int put = 0;
+        while (q->Put(1, big))
+                put++;
+        auto st = q->GetStats();
+        assert(put > 10 && st.full == 1 && st.pending == (u64)put);
+        pool->Shutdown(true);
+        gate.unlock();
+        pool->AwaitTermination(0);
+        //dropped works go with the pool
+        delete pool;
+        delete q;
+
+        ran = 0;
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        q = new DurableQueue(pool, path);
+        q->Register(1, check);
+        assert(q->Start());
+        assert(q->GetStats().replayed == (u64)put);
+        delete q;
+        assert(ran == put);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+        unlink(path);
+}
+
+void test_durable3()
+{//works the pool refuses or that throw are acknowledged and never wedge the log
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const char *path = "/tmp/test_durable3.log";
+        unlink(path);
+        std::atomic<int> ran(0);
+        std::string big(200, 'b');
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        auto q = new DurableQueue(pool, path, 4096 * 2);
+        q->Register(1, [&ran] (const char *, u32) {ran++;});
+        q->Register(2, [] (const char *, u32) {throw std::runtime_error("bad");});
+        assert(q->Start());
+        for (int i = 0; i < 100; i++) {
+                while (!q->Put(2, big))
+                        std::this_thread::yield();
+                while (!q->Put(1, big))
+                        std::this_thread::yield();
+        }
+        while (q->GetStats().pending != 0)
+                std::this_thread::yield();
+        auto st = q->GetStats();
+        assert(ran == 100 && st.failed == 100 && pool->GetStats().failed == 100);
+        //many laps over the log with every put refused
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        for (int i = 0; i < 1000; i++)
+                assert(q->Put(1, big) == false);
+        u64 full = st.full;
+        st = q->GetStats();
+        assert(st.refused == 1000 && st.full == full && st.pending == 0);
+        delete q;
+        delete pool;
+
+        //refused entries are never replayed
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        std::mutex gate;
+        gate.lock();
+        pool->Execute([&gate] () {gate.lock(); gate.unlock();});
+        pool->Execute([&gate] () {gate.lock(); gate.unlock();});
+        q = new DurableQueue(pool, path, 4096 * 2);
+        q->Register(1, [&ran] (const char *, u32) {ran++;});
+        assert(q->Start() && q->GetStats().replayed == 0);
+        for (int i = 0; i < 10; i++)
+                assert(q->Put(1, big));
+        pool->Shutdown(true);
+        gate.unlock();
+        pool->AwaitTermination(0);
+        assert(q->Put(1, big) == false);
+        //the accepted ones were dropped unrun and wait for another go, the
+        //cancelled one behind them waits for the cursor
+        st = q->GetStats();
+        assert(st.dropped == 10 && st.pending == 11 && ran == 100);
+        delete pool;
+        delete q;
+
+        //a replay the pool refuses comes back on the next Start()
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        q = new DurableQueue(pool, path, 4096 * 2);
+        q->Register(1, [&ran] (const char *, u32) {ran++;});
+        assert(q->Start() && q->GetStats().replayed == 10);
+        assert(q->GetStats().pending == 10);
+        delete q;
+        delete pool;
+
+        ran = 0;
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        q = new DurableQueue(pool, path, 4096 * 2);
+        q->Register(1, [&ran] (const char *, u32) {ran++;});
+        assert(q->Start() && q->GetStats().replayed == 10);
+        delete q;
+        assert(ran == 10);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+        unlink(path);
+}
+
+void test_workload1()
+{//recorded works come back from the trace file and replay into another pool
+        cout << "============================ " << __func__ << " ==============" << endl;
+        const char *path = "/tmp/test_workload1.trace";
+        auto spin = [] () {
+                auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(200);
+                while (std::chrono::steady_clock::now() < end)
+                        ;
+        };
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        assert(pool->FlushWorkload(path) == false);
+        pool->Execute([] () {});//before recording
+        while (pool->GetStats().served == 0 || pool->GetActiveCount() != 0)
+                std::this_thread::yield();
+        assert(pool->EnableWorkloadRecording());
+        std::vector<std::thread> subs;
+        for (u32 t = 1; t <= 2; t++)
+                subs.emplace_back([pool, t, &spin] () {
+                                for (int i = 0; i < 50; i++)
+                                        pool->Execute(t, spin);
+                        });
+        for (auto &t : subs)
+                t.join();
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        pool->DisableWorkloadRecording();
+        assert(pool->FlushWorkload(path));
+        delete pool;
+        std::vector<WorkloadRecord> recs;
+        assert(ReadWorkload(path, recs));
+        assert(recs.size() == 100);
+        std::map<u32, u32> tenantOf;
+        for (size_t i = 0; i < recs.size(); i++) {
+                assert(i == 0 || recs[i - 1].arrival <= recs[i].arrival);
+                assert(recs[i].run >= 200 * 1000);
+                //every submitter put the works of one tenant
+                auto it = tenantOf.insert(std::make_pair(recs[i].submitter, recs[i].tenant)).first;
+                assert(it->second == recs[i].tenant);
+        }
+        assert(tenantOf.size() == 2);
+
+        //a limited recorder keeps the first works
+        pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        assert(pool->EnableWorkloadRecording(10));
+        for (int i = 0; i < 20; i++)
+                pool->Execute([] () {});
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(pool->FlushWorkload(path));
+        delete pool;
+        std::vector<WorkloadRecord> few;
+        assert(ReadWorkload(path, few) && few.size() == 10);
+
+        pool = ThreadPoolExecutor::NewFixedThreadPool(2);
+        auto rp = ReplayWorkload(pool, recs, 4);
+        assert(rp.works == 100 && rp.submitters == 2);
+        assert(rp.peakThreads <= 2 && rp.seconds > 0);
+        assert(rp.waitP50 <= rp.waitP99 && rp.waitP99 <= rp.waitMax);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+
+        //works a waiting worker runs itself are recorded too, not in the
+        //running time of the one that waited
+        pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        assert(pool->EnableWorkloadRecording());
+        Latch outer(1);
+        auto t0 = std::chrono::steady_clock::now();
+        pool->Execute([pool, &spin, &outer] () {
+                        Latch l(10);
+                        for (int i = 0; i < 10; i++)
+                                pool->Execute([&l, &spin] () {spin(); l.CountDown();});
+                        l.Wait();
+                        outer.CountDown();
+                });
+        outer.Wait();
+        u64 wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        assert(pool->FlushWorkload(path));
+        delete pool;
+        std::vector<WorkloadRecord> nested;
+        assert(ReadWorkload(path, nested) && nested.size() == 11);
+        //by arrival, the outer one was put before it put the others
+        u64 sum = nested[0].run;
+        for (size_t i = 1; i < nested.size(); i++) {
+                assert(nested[i].arrival > nested[0].arrival);
+                assert(nested[i].run >= 200 * 1000);
+                sum += nested[i].run;
+        }
+        //counted once: in the outer one they would add up to twice as much
+        assert(sum <= wall);
+
+        //a cut file is no trace
+        assert(WriteWorkload(path, recs));
+        assert(truncate(path, 20) == 0);
+        assert(ReadWorkload(path, recs) == false);
+        unlink(path);
+}
+
+void test_sync1()
+{//latch, barrier and event, from plain threads and from waiting workers
+        cout << "============================ " << __func__ << " ==============" << endl;
+        Latch l(4);
+        std::vector<std::thread> ths;
+        for (int i = 0; i < 4; i++)
+                ths.emplace_back([&l] () {l.CountDown();});
+        l.Wait();
+        assert(l.TryWait());
+        for (auto &t : ths)
+                t.join();
+        ths.clear();
+        Latch never(1);
+        never.SetSpin(0);
+        assert(never.WaitFor(10) == false);
+        never.CountDown(5);//more than left
+        assert(never.WaitFor(10));
+
+        const u32 PHASES = 100;
+        u32 seen[4] = {0};
+        std::atomic<u32> serial(0);
+        u32 done = 0;
+        Barrier b(4, [&] () {
+                        //every party wrote its phase before arriving
+                        for (int i = 0; i < 4; i++)
+                                assert(seen[i] == done + 1);
+                        done++;
+                });
+        for (int i = 0; i < 4; i++)
+                ths.emplace_back([&, i] () {
+                                for (u32 ph = 0; ph < PHASES; ph++) {
+                                        seen[i] = ph + 1;
+                                        if (b.ArriveAndWait())
+                                                serial++;
+                                        assert(done == ph + 1);
+                                }
+                        });
+        for (auto &t : ths)
+                t.join();
+        ths.clear();
+        assert(done == PHASES && serial == PHASES && b.GetPhase() == PHASES);
+
+        Event ev;
+        assert(ev.WaitFor(10) == false);
+        std::atomic<int> woke(0);
+        for (int i = 0; i < 3; i++)
+                ths.emplace_back([&] () {ev.Wait(); woke++;});
+        sleep_sec(0.01f);
+        ev.Set();
+        for (auto &t : ths)
+                t.join();
+        ths.clear();
+        assert(woke == 3 && ev.IsSet() && ev.WaitFor(10));
+        ev.Reset();
+        assert(!ev.IsSet() && ev.WaitFor(10) == false);
+        //a pulse still releases those already waiting
+        ev.SetSpin(0);
+        ths.emplace_back([&] () {ev.Wait(); woke++;});
+        sleep_sec(0.01f);
+        ev.Set();
+        ev.Reset();
+        ths[0].join();
+        ths.clear();
+        assert(woke == 4);
+
+        //the only worker waits for works queued behind it and runs them itself
+        auto pool = ThreadPoolExecutor::NewSingleThreadExecutor();
+        std::mutex gate;
+        gate.lock();
+        pool->Execute([&gate] () {gate.lock(); gate.unlock();});
+        Latch all(8);
+        std::thread::id waiter, ran[8];
+        pool->Execute([&] () {
+                        waiter = std::this_thread::get_id();
+                        all.Wait();
+                });
+        for (int i = 0; i < 8; i++)
+                pool->Execute([&, i] () {
+                                ran[i] = std::this_thread::get_id();
+                                all.CountDown();
+                        });
+        gate.unlock();
+        all.Wait();
+        for (int i = 0; i < 8; i++)
+                assert(ran[i] == waiter);
+        //one phase of more parties than workers
+        Barrier pb(6);
+        Latch left(6);
+        for (int i = 0; i < 6; i++)
+                pool->Execute([&] () {pb.ArriveAndWait(); left.CountDown();});
+        left.Wait();
+        assert(pb.GetPhase() == 1);
+        //a worker hosts at most 8 helped waiters over its own plus the rest
+        //of its batch, the others wait on replacements
+        Barrier deep(40);
+        Latch out(40);
+        std::mutex idl;
+        std::map<std::thread::id, int> hosts;
+        for (int i = 0; i < 40; i++)
+                pool->Execute([&] () {
+                                {
+                                        std::lock_guard<std::mutex> lk(idl);
+                                        hosts[std::this_thread::get_id()]++;
+                                }
+                                deep.ArriveAndWait();
+                                out.CountDown();
+                        });
+        out.Wait();
+        assert(hosts.size() > 1);
+        for (auto &h : hosts)
+                assert(h.second <= 9 + 16);
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        delete pool;
+}
+
+void test_exception1()
+{//throwing works neither kill their worker nor stall strands and serial executors
+        cout << "============================ " << __func__ << " ==============" << endl;
+        ThreadAttributes attr;
+        std::atomic<int> starts(0);
+        attr.onStart = [&starts] () {
+                if (starts++ == 0)
+                        throw std::runtime_error("hook");
+        };
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(2, attr);
+        std::mutex lock;
+        std::vector<std::string> caught;
+        assert(pool->SetExceptionHandler([&] (std::exception_ptr e, const char *name) {
+                                std::string what;
+                                try {
+                                        std::rethrow_exception(e);
+                                } catch (const std::exception &ex) {
+                                        what = ex.what();
+                                } catch (...) {
+                                        what = "?";
+                                }
+                                std::lock_guard<std::mutex> lk(lock);
+                                caught.push_back(std::string(name ? name : "") + ":" + what);
+                                if (what == "again")
+                                        throw 1;//handlers may fail too
+                        }));
+        std::atomic<int> ran(0);
+        for (int i = 0; i < 100; i++) {
+                pool->Execute([&ran] () {ran++;});
+                if (i % 10 == 0)
+                        pool->Execute([] () {throw std::runtime_error("boom");}, "bad");
+        }
+        pool->Execute([] () {throw 42;}, "int");
+        pool->Execute([] () {throw std::runtime_error("again");});
+        //Submit() keeps its exception in the future
+        auto f = pool->Submit([] () -> int {throw std::runtime_error("mine");});
+        bool thrown = false;
+        try {
+                f.get();
+        } catch (const std::runtime_error &) {
+                thrown = true;
+        }
+        assert(thrown);
+
+        //the works after a throwing one keep their order and run
+        Strand strand(pool);
+        SerialExecutor ser(pool);
+        std::vector<int> so, eo;
+        for (int i = 0; i < 50; i++) {
+                strand.Execute([&so, i] () {
+                                if (i % 7 == 3)
+                                        throw std::runtime_error("strand");
+                                so.push_back(i);
+                        });
+                ser.Execute([&eo, i] () {
+                                if (i % 7 == 3)
+                                        throw std::runtime_error("serial");
+                                eo.push_back(i);
+                        });
+        }
+        strand.Submit([] () {return 0;}).get();
+        ser.Submit([] () {return 0;}).get();
+        assert(so.size() == 43 && eo.size() == 43);
+        assert(std::is_sorted(so.begin(), so.end()) && std::is_sorted(eo.begin(), eo.end()));
+
+        pool->Shutdown(false);
+        pool->AwaitTermination(0);
+        auto st = pool->GetStats();
+        assert(ran == 100);
+        //10 boom, int, again, 7 + 7 strand and serial, the hook
+        assert(st.failed == 27 && caught.size() == 27);
+        assert(std::count(caught.begin(), caught.end(), "bad:boom") == 10);
+        assert(std::count(caught.begin(), caught.end(), "int:?") == 1);
+        assert(std::count(caught.begin(), caught.end(), ":hook") == 1);
+        assert(st.activeCount == 0 && st.poolSize == 0);
+        delete pool;
+}
+
+void test_completion1()
+{//results come back in completion order, not submission order
+        cout << "============================ " << __func__ << " ==============" << endl;
+        auto pool = ThreadPoolExecutor::NewFixedThreadPool(8);
+        {
+                CompletionService<int> cs(pool);
+                for (int i = 0; i < 8; i++)
+                        assert(cs.Submit([i] () {
+                                                sleep_sec(0.1f * (8 - i));
+                                                return i;
+                                        }));
+                assert(cs.GetPending() == 8);
+                std::future<int> f;
+                assert(cs.Poll(f, 10) == false);
+                assert(cs.Take().get() == 7);
+                assert(cs.Poll(f, 1000) && f.get() == 6);
+                std::vector<std::future<int> > out;
+                sleep_sec(0.35f);
+                //5, 4 and 3 finished meanwhile
+                assert(cs.TakeBatch(out, 16) == 3);
+                assert(out[0].get() == 5 && out[2].get() == 3);
+                out.clear();
+                size_t n = 0;
+                while (n < 3)
+                        n += cs.TakeBatch(out, 2);
+                assert(cs.GetPending() == 0);
+                //exceptions come back too
+                cs.Submit([] () -> int {throw std::runtime_error("shard down");});
+                bool thrown = false;
+                try {
+                        cs.Take().get();
+                } catch (const std::runtime_error &) {
+                        thrown = true;
+                }
+                assert(thrown);
+                //many producers, left to the destructor
+                for (int i = 0; i < 10000; i++)
+                        cs.Submit([i] () {return i;});
+                for (int i = 0; i < 5000; i++)
+                        cs.Take();
+        }
+        pool->Shutdown(false);
+        CompletionService<int> cs(pool);
+        assert(cs.Submit([] () {return 0;}) == false && cs.GetPending() == 0);
+        delete pool;
+
+        //works dropped unrun come back broken
+        pool = ThreadPoolExecutor::NewFixedThreadPool(1);
+        std::mutex gate;
+        gate.lock();
+        pool->Execute([&gate] () {gate.lock(); gate.unlock();});
+        {
+                CompletionService<int> cs(pool);
+                for (int i = 0; i < 3; i++)
+                        assert(cs.Submit([i] () {return i;}));
+                std::vector<std::future<int> > none;
+                assert(cs.TakeBatch(none, 0) == 0 && none.empty());
+                pool->Shutdown(true);
+                gate.unlock();
+                //the last worker leaving drops them, the pool stays
+                for (int i = 0; i < 3; i++) {
+                        auto f = cs.Take();
+                        try {
+                                f.get();
+                                assert(false);
+                        } catch (const std::future_error &e) {
+                                assert(e.code() == std::future_errc::broken_promise);
+                        }
+                }
+                assert(cs.GetPending() == 0);
+        }
+        assert(pool->AwaitTermination(5));
+        //so do strands on it, and the pool takes no new works
+        {
+                auto p2 = ThreadPoolExecutor::NewFixedThreadPool(1);
+                Strand strand(p2);
+                std::mutex g2;
+                g2.lock();
+                p2->Execute([&g2] () {g2.lock(); g2.unlock();});
+                CompletionService<int> cs(&strand);
+                assert(cs.Submit([] () {return 1;}));
+                p2->Shutdown(true);
+                g2.unlock();
+                assert(p2->AwaitTermination(5));
+                assert(strand.GetPending() == 0);
+                bool broken = false;
+                try {
+                        cs.Take().get();
+                } catch (const std::future_error &e) {
+                        broken = e.code() == std::future_errc::broken_promise;
+                }
+                assert(broken);
+                delete p2;
+        }
+        delete pool;
+}
+
 int tmain()
 {
         for (auto i = 0; i < 32; i++) {
@@ -672,6 +2576,38 @@ int tmain()
                 test_fuck();
                 test_functional();
                 test_idle();
+                test_tenant1();
+                test_tenant2();
+                test_strand1();
+                test_partition1();
+                test_partition2();
+                test_ManagedBlock1();
+#ifdef __linux__
+                test_reactor1();
+#endif
+                test_trace1();
+                test_perf1();
+                test_watchdog1();
+                test_attributes1();
+                test_arena1();
+                test_batch1();
+                test_lifo1();
+                test_spin1();
+                test_pipeline1();
+                test_arbiter1();
+                test_basic1();
+                test_executor1();
+                test_completion1();
+                test_shard1();
+                test_admission1();
+                test_shed1();
+                test_parallel1();
+                test_durable1();
+                test_durable2();
+                test_durable3();
+                test_workload1();
+                test_sync1();
+                test_exception1();
         }
 
 
@@ -1,20 +1,215 @@
 #include "ThreadPoolExecutor.h"
+#include "Trace.h"
+#include "Workload.h"
+#include "PerfCounters.h"
+#include "Arena.h"
+#include "CpuArbiter.h"
 #include <cassert>
+#include <fstream>
+#include <system_error>
+#include <climits>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 //#include <iostream>
 
+//arena of the worker running on this thread
+static thread_local Arena *tl_arena = nullptr;
+
+//cpu permit of the worker running on this thread
+struct Permit {
+        ThreadPoolExecutor *pool;
+        CpuArbiter *arb;
+        bool held;
+        void *batch;//works taken by the worker, for RunQueued()
+        size_t next;//the first of them not started yet
+        u64 helped;//ns spent in works run by RunQueued(), when recording
+};
+static thread_local Permit *tl_permit = nullptr;
+
+static inline u64 now_ns()
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//small id of the calling thread, the submitter of workload records
+static inline u32 submitter_id()
+{
+        static std::atomic<u32> next(1);
+        static thread_local u32 id = next++;
+        return id;
+}
+
 ThreadPoolExecutor::~ThreadPoolExecutor()
 {
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                wstop = true;
+                wcv.notify_all();
+        }
+        if (wdt.joinable())
+                wdt.join();
         Shutdown(true);
         AwaitTermination(dtm);
+        if (arb)
+                arb.load()->Unregister(this);
+        delete tracer;
+        delete wrec;
+}
+
+void ThreadPoolExecutor::Trace(int type, const char *name)
+{
+        //pairs with trc = true after tracer was set, a plain load on x86
+        if (trc.load(std::memory_order_acquire))
+                tracer->Record((Tracer::Type)type, name);
 }
 
-void ThreadPoolExecutor::Add1Thread()
+ThreadPoolExecutor *ThreadPoolExecutor::NewPartitionedThreadPool(u32 nThreads,
+                                                                 u32 nPartitions,
+                                                                 const ThreadAttributes &attr)
 {
-        std::thread th(InternalWorkerFunction, this);
-        th.detach();
+        assert(nThreads != 0);
+        if (nThreads == 0)
+                nThreads = 1;
+        if (nPartitions == 0)
+                nPartitions = nThreads * 4;
+        auto pool = new ThreadPoolExecutor(nThreads, nThreads, 0, attr);
+        std::lock_guard<std::mutex> lk(pool->lock);
+        pool->parts.resize(nPartitions);
+        for (u32 i = 0; i < nPartitions; i++)
+                pool->parts[i].owner = i % nThreads;
+        //slots must never move once workers are running
+        for (u32 i = 0; i < nThreads; i++)
+                pool->slots.emplace_back(new Slot());
+        for (u32 i = 0; i < nThreads; i++)
+                pool->Add1Thread(i);
+        return pool;
+}
+
+ThreadPoolExecutor *ThreadPoolExecutor::NewShardedThreadPool(u32 nThreads,
+                                                             u32 nShards,
+                                                             const ThreadAttributes &attr)
+{
+        assert(nThreads != 0);
+        if (nThreads == 0)
+                nThreads = 1;
+        if (nShards == 0)
+                nShards = (nThreads / 4 > 2) ? nThreads / 4 : 2;
+        auto pool = new ThreadPoolExecutor(nThreads, nThreads, 0, attr);
+        std::lock_guard<std::mutex> lk(pool->lock);
+        //shards must never move once producers may see them
+        for (u32 i = 0; i < nShards; i++)
+                pool->shards.emplace_back(new Shard());
+        for (u32 i = 0; i < nThreads; i++)
+                pool->Add1Thread();
+        return pool;
+}
+
+struct WorkerArgs {
+        ThreadPoolExecutor *pool;
+        u32 slot;
+        void *rs;
+        std::string name;
+        int nice;
+        std::function<void()> onStart;
+        std::function<void()> onExit;//our own copy, the pool may be gone at exit
+};
+
+void ThreadPoolExecutor::Add1Thread(u32 slot)
+{
+        runs.emplace_back();
+        RunSlot *rs = &runs.back();
+        rs->id = wid++;
+        rs->start = 0;
+        rs->name = nullptr;
+        rs->reported = 0;
+        rs->comp = false;
+        rs->it = --runs.end();
+        WorkerArgs *wa = new WorkerArgs();
+        wa->pool = this;
+        wa->slot = slot;
+        wa->rs = rs;
+        if (!tattr.name.empty())
+                wa->name = tattr.name + "-" + std::to_string(rs->id);
+        wa->nice = tattr.nice;
+        wa->onStart = tattr.onStart;
+        wa->onExit = tattr.onExit;
+
+        pthread_attr_t pa;
+        pthread_attr_init(&pa);
+        pthread_attr_setdetachstate(&pa, PTHREAD_CREATE_DETACHED);
+        if (tattr.stackSize != 0) {
+                size_t sz = tattr.stackSize;
+                if (sz < (size_t)PTHREAD_STACK_MIN)
+                        sz = PTHREAD_STACK_MIN;
+                pthread_attr_setstacksize(&pa, sz);
+        }
+        if (tattr.guardSize != 0)
+                pthread_attr_setguardsize(&pa, tattr.guardSize);
+        if (tattr.policy >= 0) {
+                sched_param sp;
+                sp.sched_priority = tattr.priority;
+                pthread_attr_setinheritsched(&pa, PTHREAD_EXPLICIT_SCHED);
+                pthread_attr_setschedpolicy(&pa, tattr.policy);
+                pthread_attr_setschedparam(&pa, &sp);
+        }
+        pthread_t th;
+        int err = pthread_create(&th, &pa, ThreadEntry, wa);
+        if (err == EPERM && tattr.policy >= 0) {
+                //not allowed to pick the policy, fall back to inheriting it
+                pthread_attr_setinheritsched(&pa, PTHREAD_INHERIT_SCHED);
+                err = pthread_create(&th, &pa, ThreadEntry, wa);
+        }
+        pthread_attr_destroy(&pa);
+        if (err != 0) {
+                //same as std::thread would do
+                runs.pop_back();
+                delete wa;
+                throw std::system_error(err, std::system_category(), "pthread_create");
+        }
         cur++;
 }
 
+void *ThreadPoolExecutor::ThreadEntry(void *arg)
+{
+        WorkerArgs *wa = (WorkerArgs *)arg;
+        if (!wa->name.empty()) {
+                //15 characters plus the terminating 0 on Linux
+                std::string nm = wa->name.substr(0, 15);
+#if defined(__APPLE__)
+                pthread_setname_np(nm.c_str());
+#else
+                pthread_setname_np(pthread_self(), nm.c_str());
+#endif
+        }
+#ifdef __linux__
+        if (wa->nice != 0)
+                setpriority(PRIO_PROCESS, syscall(SYS_gettid), wa->nice);
+#endif
+        //a throwing hook must not take the worker, and its place in cur,
+        //with it. The pool may be gone at exit, that one is just dropped
+        if (wa->onStart) {
+                try {
+                        wa->onStart();
+                } catch (...) {
+                        wa->pool->Fail(nullptr);
+                }
+        }
+        InternalWorkerFunction(wa->pool, wa->slot, (RunSlot *)wa->rs);
+        if (wa->onExit) {
+                try {
+                        wa->onExit();
+                } catch (...) {
+                }
+        }
+        delete wa;
+        return nullptr;
+}
+
 bool ThreadPoolExecutor::PrestartAllMinThreads()
 {
         std::lock_guard<std::mutex> lk(lock);
@@ -41,7 +236,7 @@ u32 ThreadPoolExecutor::GetMinPoolSize()
 bool ThreadPoolExecutor::SetMinPoolSize(u32 amin)
 {
         std::lock_guard<std::mutex> lk(lock);
-        if (state != RUNNING || amin > max)
+        if (state != RUNNING || amin > max || !slots.empty())
                 return false;
         min = amin;
         return true;
@@ -56,7 +251,7 @@ u32 ThreadPoolExecutor::GetMaxPoolSize()
 bool ThreadPoolExecutor::SetMaxPoolSize(u32 amax)
 {
         std::lock_guard<std::mutex> lk(lock);
-        if (state != RUNNING || min > amax || amax == 0)
+        if (state != RUNNING || min > amax || amax == 0 || !slots.empty())
                 return false;
         int diff = cur - amax;
         max = amax;
@@ -71,7 +266,7 @@ bool ThreadPoolExecutor::SetMaxPoolSize(u32 amax)
                 //we need this to make sure that when the pool size is expanded
                 //SetMaxPoolSize(), the actual number of threads would also grow
                 int maxadd = amax - cur;
-                int needadd = req_q.size() + act - cur;
+                int needadd = qlen + act - cur;
                 int toadd = (maxadd > needadd) ? needadd : maxadd;
                 for (auto i = 0; i < toadd; i++)
                         Add1Thread();
@@ -107,12 +302,21 @@ bool ThreadPoolExecutor::SetKeepAliveTime(u32 alive_sec)
 void ThreadPoolExecutor::CommonCleanup()
 {//this is already guarded by a lock
         state = QUITTING;
+        //draining must not wait for other pools
+        if (arb)
+                arb.load()->Cancel(this);
         //make sure that every thread can get this message
         //should not use notify_all because that will not let those
         //active threads know the message, because they would be waiting
         //for semaphore value
         for (u32 i = 0; i < cur; i++)
                 sem.post();
+        for (auto &sl : slots)
+                sl->sem.post();
+        for (auto &sh : shards) {
+                std::lock_guard<std::mutex> lk(sh->lock);
+                sh->closed = true;
+        }
         if (cur == 0) {
                 state = DEAD;
                 quitCond.notify_all();
@@ -122,11 +326,15 @@ void ThreadPoolExecutor::CommonCleanup()
 
 void ThreadPoolExecutor::Shutdown(bool asap)
 {
+        std::vector<std::function<void()> > dropped;
         std::lock_guard<std::mutex> lk(lock);
         if (state != RUNNING)
                 return;
         qbd = asap;
         CommonCleanup();
+        //no worker left to drop them, destroyed after lk is released
+        if (asap && cur == 0)
+                DropQueued(dropped);
 }
 
 bool ThreadPoolExecutor::IsShutdown()
@@ -154,17 +362,919 @@ bool ThreadPoolExecutor::AwaitTermination(u32 alive_sec)
 
 bool ThreadPoolExecutor::Execute(const std::function<void()>& task)
 {
+        return Execute(0, task, nullptr);
+}
+
+bool ThreadPoolExecutor::Execute(const std::function<void()>& task, const char *name)
+{
+        return Execute(0, task, name);
+}
+
+bool ThreadPoolExecutor::Execute(u32 tenant, const std::function<void()>& task,
+                                 const char *name)
+{
+        if (ovl.load(std::memory_order_relaxed))
+                return Shed(task);
+        if (!shards.empty())
+                return PushShard(&task, 1, name);
         std::lock_guard<std::mutex> lk(lock);
         if (state != RUNNING)
                 return false;
-        req_q.emplace_back(task);
+        Enqueue(tenant, task, name);
+        return true;
+}
+
+bool ThreadPoolExecutor::ExecuteBatch(const std::vector<std::function<void()> > &tasks,
+                                      u32 tenant)
+{
+        if (ovl.load(std::memory_order_relaxed)) {
+                bool all = true;
+                for (auto &task : tasks)
+                        all = Shed(task) && all;
+                return all;
+        }
+        if (!shards.empty())
+                return PushShard(tasks.data(), tasks.size(), nullptr);
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        for (auto &task : tasks)
+                Enqueue(tenant, task, nullptr);
+        return true;
+}
+
+void ThreadPoolExecutor::Enqueue(u32 tenant, const std::function<void()> &task,
+                                 const char *name)
+{//this is already guarded by a lock
+        Trace(Tracer::ENQUEUE, name);
+        if (!slots.empty()) {
+                PushPartition(kctr++ % parts.size(), task, name);
+                return;
+        }
+        Tenant &tn = tenants[tenant];
+        if (tn.req_q.empty())
+                rr_q.push_back(tenant);
+        tn.req_q.push_back(Task());
+        tn.req_q.back().fn = task;
+        tn.req_q.back().name = name;
+        tn.req_q.back().tenant = tenant;
+        tn.req_q.back().part = NONE;
+        tn.req_q.back().enq = Stamp();
+        tn.req_q.back().sub = wrc.load(std::memory_order_relaxed) ? submitter_id() : 0;
+        qlen++;
         assert(cur >= act);
         u32 diff = cur - act;
-        bool nmt = (diff < req_q.size());//need more threads
-        if (cur < min || (nmt && cur < max)) {//lower than min or all busy
+        //need more threads, unless busy ones only wait for a cpu permit
+        bool nmt = (diff < qlen) && awt.load(std::memory_order_relaxed) == 0;
+        if (cur < min || (nmt && cur < Limit())) {//lower than min or all busy
                 Add1Thread();
         }
         sem.post();
+}
+
+static inline u32 ShardRand()
+{//xorshift, one state per producer thread
+        static thread_local u32 x = 0;
+        if (x == 0) {
+                x = (u32)std::hash<std::thread::id>()(std::this_thread::get_id())
+                        ^ (u32)now_ns();
+                x |= 1;
+        }
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+}
+
+bool ThreadPoolExecutor::PushShard(const std::function<void()> *tasks, size_t n,
+                                   const char *name)
+{
+        //power of two choices: the shorter of two random shards
+        u32 ns = shards.size();
+        Shard *a = shards[ShardRand() % ns].get();
+        Shard *b = shards[ShardRand() % ns].get();
+        Shard *sh = (b->len.load(std::memory_order_relaxed)
+                     < a->len.load(std::memory_order_relaxed)) ? b : a;
+        u64 enq = Stamp();
+        u32 sub = wrc.load(std::memory_order_relaxed) ? submitter_id() : 0;
+        {
+                std::lock_guard<std::mutex> lk(sh->lock);
+                if (sh->closed)
+                        return false;
+                for (size_t i = 0; i < n; i++) {
+                        sh->req_q.push_back(Task());
+                        sh->req_q.back().fn = tasks[i];
+                        sh->req_q.back().name = name;
+                        sh->req_q.back().tenant = 0;
+                        sh->req_q.back().part = NONE;
+                        sh->req_q.back().enq = enq;
+                        sh->req_q.back().sub = sub;
+                }
+                //pairs with sidle++ then ShardLen() of a parking worker, one
+                //of the two sees the other
+                sh->len.fetch_add(n);
+                //post only while some parked worker has no wakeup coming, a
+                //busy pool is never touched at all. Still under the shard
+                //lock like Enqueue(), a worker we wake waits for us here
+                //instead of taking our works one by one
+                for (size_t i = 0; i < n; i++) {
+                        int sg = ssig.load();
+                        bool need;
+                        while ((need = sidle.load() > sg)
+                               && !ssig.compare_exchange_weak(sg, sg + 1))
+                                ;
+                        if (!need)
+                                break;
+                        sem.post();
+                }
+        }
+        for (size_t i = 0; i < n; i++)
+                Trace(Tracer::ENQUEUE, name);
+        //a fixed pool with blocked workers may have none left for these
+        if (blk.load(std::memory_order_relaxed) != 0) {
+                std::lock_guard<std::mutex> lk(lock);
+                Compensate();
+        }
+        return true;
+}
+
+u32 ThreadPoolExecutor::ShardLen()
+{
+        u32 n = 0;
+        for (auto &sh : shards)
+                n += sh->len.load();
+        return n;
+}
+
+bool ThreadPoolExecutor::PopShard(u32 home, u32 n, std::vector<Task> &batch)
+{//this is already guarded by a lock
+        u32 ns = shards.size();
+        for (u32 i = 0; i < ns; i++) {
+                Shard *sh = shards[(home + i) % ns].get();
+                if (sh->len.load(std::memory_order_relaxed) == 0)
+                        continue;
+                std::lock_guard<std::mutex> lk(sh->lock);
+                Tenant &tn = tenants[0];
+                while (n > 0 && !sh->req_q.empty()) {
+                        batch.push_back(std::move(sh->req_q.front()));
+                        sh->req_q.pop_front();
+                        sh->len--;
+                        tn.act++;
+                        tn.served++;
+                        served++;
+                        n--;
+                }
+                if (!batch.empty())
+                        return true;
+        }
+        return false;
+}
+
+bool ThreadPoolExecutor::SetTenant(u32 tenant, u32 weight, u32 maxActive)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || weight == 0)
+                return false;
+        Tenant &tn = tenants[tenant];
+        bool capped = tn.cap != 0 && tn.act >= tn.cap;
+        tn.weight = weight;
+        tn.cap = maxActive;
+        if (tn.deficit > weight)
+                tn.deficit = weight;
+        //limit raised, let waiting workers pick the blocked works
+        if (capped && (tn.cap == 0 || tn.act < tn.cap)) {
+                u32 n = tn.req_q.size();
+                for (u32 i = 0; i < n; i++)
+                        sem.post();
+        }
+        return true;
+}
+
+bool ThreadPoolExecutor::ExecuteByKey(u64 key, const std::function<void()> &task,
+                                      const char *name)
+{
+        if (ovl.load(std::memory_order_relaxed) && !slots.empty())
+                return Shed(task);
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || slots.empty())
+                return false;
+        //fibonacci hashing, spreads sequential keys over partitions
+        u32 p = ((key * 0x9E3779B97F4A7C15ull) >> 32) % parts.size();
+        Trace(Tracer::ENQUEUE, name);
+        PushPartition(p, task, name);
+        u32 owner = parts[p].owner;
+        if (rbt != 0 && slots[owner]->backlog > rbt)
+                Rebalance(owner, p);
+        return true;
+}
+
+bool ThreadPoolExecutor::SetRebalanceThreshold(u32 threshold)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || slots.empty())
+                return false;
+        rbt = threshold;
+        return true;
+}
+
+void ThreadPoolExecutor::PushPartition(u32 p, const std::function<void()> &task,
+                                       const char *name)
+{//this is already guarded by a lock
+        Partition &pt = parts[p];
+        Slot *sl = slots[pt.owner].get();
+        if (pt.req_q.empty())
+                sl->ready.push_back(p);
+        pt.req_q.push_back(Task());
+        pt.req_q.back().fn = task;
+        pt.req_q.back().name = name;
+        pt.req_q.back().tenant = 0;
+        pt.req_q.back().part = p;
+        pt.req_q.back().enq = Stamp();
+        pt.req_q.back().sub = wrc.load(std::memory_order_relaxed) ? submitter_id() : 0;
+        sl->backlog++;
+        qlen++;
+        sl->sem.post();
+}
+
+bool ThreadPoolExecutor::PopPartition(Slot *sl, Task &t)
+{//this is already guarded by a lock
+        if (sl->ready.empty())
+                return false;
+        u32 p = sl->ready.front();
+        Partition &pt = parts[p];
+        t = std::move(pt.req_q.front());
+        pt.req_q.pop_front();
+        pt.busy++;
+        pt.served++;
+        sl->ready.pop_front();
+        //round robin over owned partitions
+        if (!pt.req_q.empty())
+                sl->ready.push_back(p);
+        sl->backlog--;
+        qlen--;
+        served++;
+        return true;
+}
+
+void ThreadPoolExecutor::Rebalance(u32 from, u32 hot)
+{//this is already guarded by a lock
+        u32 to = from;
+        for (u32 i = 0; i < slots.size(); i++)
+                if (slots[i]->backlog < slots[to]->backlog)
+                        to = i;
+        if (to == from)
+                return;
+        Slot *src = slots[from].get();
+        Slot *dst = slots[to].get();
+        //move one other idle partition away so the hot one gets more of its
+        //worker, never move a partition while one of its works is running
+        for (u32 p = 0; p < parts.size(); p++) {
+                Partition &pt = parts[p];
+                u32 n = pt.req_q.size();
+                if (p == hot || pt.owner != from || pt.busy != 0
+                    || dst->backlog + n >= src->backlog)
+                        continue;
+                pt.owner = to;
+                if (n != 0) {
+                        src->ready.remove(p);
+                        dst->ready.push_back(p);
+                        src->backlog -= n;
+                        dst->backlog += n;
+                        //posts already made to src turn into spurious wakeups
+                        for (u32 i = 0; i < n; i++)
+                                dst->sem.post();
+                }
+                rebalances++;
+                return;
+        }
+}
+
+void ThreadPoolExecutor::ManagedBlock(const std::function<void()> &blocker)
+{
+        //end the region even if blocker throws
+        struct Region {
+                ThreadPoolExecutor *pool;
+                ~Region() {pool->EndBlocking();}
+        };
+        BeginBlocking();
+        Region r = {this};
+        blocker();
+}
+
+void ThreadPoolExecutor::BeginBlocking()
+{
+        //a blocked worker does not use its core, let others have it
+        Permit *pm = tl_permit;
+        if (pm && pm->pool == this && pm->held) {
+                pm->arb->Release(this);
+                pm->held = false;
+        }
+        std::lock_guard<std::mutex> lk(lock);
+        Block();
+}
+
+void ThreadPoolExecutor::EndBlocking()
+{
+        Permit *pm = tl_permit;
+        bool wait = pm && pm->pool == this && pm->arb && !pm->held;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                Unblock();
+                if (wait)
+                        awt++;
+        }
+        if (wait) {
+                pm->held = pm->arb->Acquire(this);
+                awt--;
+        }
+}
+
+void ThreadPoolExecutor::Block()
+{//this is already guarded by a lock
+        blk++;
+        Compensate();
+}
+
+void ThreadPoolExecutor::Compensate()
+{//this is already guarded by a lock
+        if (!slots.empty() || (state == QUITTING && qbd))
+                return;
+        //pending works that no idle worker can take, start a compensating one
+        assert(cur >= act);
+        u32 pending = shards.empty() ? qlen : ShardLen();
+        if (pending > cur - act && cur < Limit() && awt.load(std::memory_order_relaxed) == 0) {
+                Add1Thread();
+                //still draining after Shutdown(), the quit posts were made
+                //before this worker existed
+                if (state == QUITTING)
+                        sem.post();
+        }
+}
+
+void ThreadPoolExecutor::Unblock()
+{//this is already guarded by a lock
+        assert(blk > 0);
+        blk--;
+        //let one worker see that the pool is over its limit and retire
+        if (slots.empty() && cur > Limit())
+                sem.post();
+}
+
+bool ThreadPoolExecutor::SetCompensationLimit(u32 n)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        cmp = n;
+        return true;
+}
+
+bool ThreadPoolExecutor::EnableTracing(u32 ringSize)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        if (tracer == nullptr)
+                tracer = new Tracer(ringSize);
+        trc = true;
+        return true;
+}
+
+void ThreadPoolExecutor::DisableTracing()
+{
+        trc = false;
+}
+
+bool ThreadPoolExecutor::FlushTrace(const char *path)
+{
+        Tracer *t;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                t = tracer;
+        }
+        if (t == nullptr)
+                return false;
+        std::ofstream out(path);
+        if (!out)
+                return false;
+        t->Flush(out);
+        return bool(out);
+}
+
+bool ThreadPoolExecutor::EnableWorkloadRecording(u32 maxRecords)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        if (wrec == nullptr)
+                wrec = new WorkloadRecorder(maxRecords);
+        wrc = true;
+        return true;
+}
+
+void ThreadPoolExecutor::DisableWorkloadRecording()
+{
+        wrc = false;
+}
+
+bool ThreadPoolExecutor::FlushWorkload(const char *path)
+{
+        WorkloadRecorder *w;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                w = wrec;
+        }
+        if (w == nullptr)
+                return false;
+        std::vector<WorkloadRecord> recs;
+        u64 dropped;
+        w->Collect(recs, dropped);
+        return WriteWorkload(path, recs);
+}
+
+bool ThreadPoolExecutor::EnablePerfCounters(bool on)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        prf = on;
+        return true;
+}
+
+void ThreadPoolExecutor::AccountPerf(const char *name, const u64 *v0, const u64 *v1)
+{//this is already guarded by a lock
+        if (name == nullptr)
+                name = "";
+        auto it = pstats.find(name);
+        if (it == pstats.end()) {
+                PerfStats ps;
+                memset(&ps, 0, sizeof(ps));
+                ps.name = name;
+                it = pstats.insert(std::make_pair(name, ps)).first;
+        }
+        PerfStats &ps = it->second;
+        ps.works++;
+        ps.cycles += v1[PerfCounters::CYCLES] - v0[PerfCounters::CYCLES];
+        ps.instructions += v1[PerfCounters::INSTRUCTIONS] - v0[PerfCounters::INSTRUCTIONS];
+        ps.llcMisses += v1[PerfCounters::LLC_MISSES] - v0[PerfCounters::LLC_MISSES];
+        ps.ctxSwitches += v1[PerfCounters::CTX_SWITCHES] - v0[PerfCounters::CTX_SWITCHES];
+        ps.migrations += v1[PerfCounters::MIGRATIONS] - v0[PerfCounters::MIGRATIONS];
+}
+
+bool ThreadPoolExecutor::EnableWatchdog(const WatchdogConfig &cfg)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || cfg.intervalMs == 0)
+                return false;
+        wcfg = cfg;
+        if (!wdg) {
+                wdg = true;
+                wdt = std::thread(&ThreadPoolExecutor::WatchdogLoop, this);
+        }
+        wcv.notify_all();
+        return true;
+}
+
+bool ThreadPoolExecutor::SetAdmissionControl(const AdmissionConfig &cfg)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || cfg.intervalMs == 0)
+                return false;
+        acfg = cfg;
+        adm = cfg.targetUs != 0;
+        ovl = false;
+        amin = ~0ULL;
+        aend = now_ns() + (u64)cfg.intervalMs * 1000000;
+        return true;
+}
+
+u64 ThreadPoolExecutor::Stamp()
+{
+        if (wdg.load(std::memory_order_relaxed) || adm.load(std::memory_order_relaxed)
+            || wrc.load(std::memory_order_relaxed))
+                return now_ns();
+        return 0;
+}
+
+bool ThreadPoolExecutor::Shed(const std::function<void()> &task)
+{
+        std::function<void(const std::function<void()> &)> fb;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                if (state == RUNNING)
+                        fb = acfg.onReject;
+        }
+        if (!fb) {
+                rejected++;
+                return false;
+        }
+        diverted++;
+        fb(task);
+        return true;
+}
+
+void ThreadPoolExecutor::Observe(const std::vector<Task> &batch)
+{//this is already guarded by a lock
+        u64 now = now_ns();
+        for (auto &t : batch) {
+                //stamped before admission control was turned on
+                if (t.enq == 0)
+                        continue;
+                u64 d = now > t.enq ? now - t.enq : 0;
+                if (d < amin)
+                        amin = d;
+        }
+        if (now < aend)
+                return;
+        //a whole interval went by, judge it by its best case only: a burst
+        //drains at least once, a standing queue never does
+        if (amin != ~0ULL) {
+                alast = amin;
+                bool over = amin > (u64)acfg.targetUs * 1000;
+                if (over && !ovl)
+                        overloads++;
+                ovl = over;
+        }
+        amin = ~0ULL;
+        aend = now + (u64)acfg.intervalMs * 1000000;
+}
+
+u64 ThreadPoolExecutor::OldestEnqueue()
+{//this is already guarded by a lock
+        //queues are FIFO, only their heads need a look
+        u64 oldest = 0;
+        for (auto t : rr_q) {
+                u64 enq = tenants[t].req_q.front().enq;
+                if (enq != 0 && (oldest == 0 || enq < oldest))
+                        oldest = enq;
+        }
+        for (auto &pt : parts) {
+                if (pt.req_q.empty())
+                        continue;
+                u64 enq = pt.req_q.front().enq;
+                if (enq != 0 && (oldest == 0 || enq < oldest))
+                        oldest = enq;
+        }
+        for (auto &sh : shards) {
+                std::lock_guard<std::mutex> lk(sh->lock);
+                if (sh->req_q.empty())
+                        continue;
+                u64 enq = sh->req_q.front().enq;
+                if (enq != 0 && (oldest == 0 || enq < oldest))
+                        oldest = enq;
+        }
+        return oldest;
+}
+
+void ThreadPoolExecutor::WatchdogLoop()
+{
+        std::unique_lock<std::mutex> lk(lock);
+        std::vector<StallInfo> found;
+        while (!wstop) {
+                wcv.wait_for(lk, std::chrono::milliseconds(wcfg.intervalMs));
+                if (wstop)
+                        break;
+                u64 now = now_ns();
+                u64 runNs = (u64)wcfg.runMs * 1000000;
+                u64 queueNs = (u64)wcfg.queueMs * 1000000;
+                for (auto &rs : runs) {
+                        u64 start = rs.start.load(std::memory_order_acquire);
+                        if (runNs == 0 || start == 0 || rs.reported == start
+                            || now - start < runNs)
+                                continue;
+                        rs.reported = start;
+                        StallInfo si = {rs.id, rs.name.load(), (now - start) / 1000000};
+                        found.push_back(si);
+                        //like ManagedBlock(), released when the work ends.
+                        //The worker clears start without the lock, look
+                        //again once comp is up: whichever of us takes comp
+                        //back releases it
+                        if (wcfg.compensate && slots.empty()) {
+                                Block();
+                                rs.comp = true;
+                                if (rs.start.load() != start && rs.comp.exchange(false))
+                                        Unblock();
+                        }
+                }
+                u64 oldest = queueNs ? OldestEnqueue() : 0;
+                if (oldest != 0 && now - oldest >= queueNs) {
+                        if (!qrep) {
+                                StallInfo si = {NONE, nullptr, (now - oldest) / 1000000};
+                                found.push_back(si);
+                        }
+                        qrep = true;
+                } else {
+                        qrep = false;
+                }
+                if (found.empty())
+                        continue;
+                stalls += found.size();
+                auto cb = wcfg.onStall;
+                lk.unlock();
+                if (cb)
+                        for (auto &si : found)
+                                cb(si);
+                found.clear();
+                lk.lock();
+        }
+}
+
+ThreadPoolExecutor::Stats ThreadPoolExecutor::GetStats()
+{
+        std::lock_guard<std::mutex> lk(lock);
+        Stats st;
+        st.poolSize = cur;
+        st.activeCount = act;
+        st.queued = qlen + ShardLen();
+        st.served = served;
+        for (auto &it : tenants) {
+                TenantStats ts;
+                ts.tenant = it.first;
+                ts.weight = it.second.weight;
+                ts.maxActive = it.second.cap;
+                ts.queued = it.second.req_q.size();
+                ts.active = it.second.act;
+                ts.served = it.second.served;
+                ts.share = served ? (double)ts.served / served : 0;
+                st.tenants.push_back(ts);
+        }
+        for (auto &pt : parts) {
+                PartitionStats ps;
+                ps.worker = pt.owner;
+                ps.queued = pt.req_q.size();
+                ps.served = pt.served;
+                st.partitions.push_back(ps);
+        }
+        st.rebalances = rebalances;
+        st.blocked = blk;
+        for (auto &it : pstats)
+                st.perf.push_back(it.second);
+        st.perfAvailable = pavl;
+        st.stalls = stalls;
+        st.batches = batches;
+        st.admission.enabled = adm;
+        st.admission.overloaded = ovl;
+        st.admission.minSojournUs = alast / 1000;
+        st.admission.overloads = overloads;
+        st.admission.rejected = rejected;
+        st.admission.diverted = diverted;
+        st.failed = failed;
+        return st;
+}
+
+bool ThreadPoolExecutor::PopBatch(Slot *sl, u32 home, std::vector<Task> &batch)
+{//this is already guarded by a lock
+        u32 n = 1;
+        bool shd = !shards.empty();
+        //works in a batch are out of reach of compensating workers, a stuck
+        //work would hold them back
+        if (mbt > 1 && !(wdg && wcfg.compensate)) {
+                //a fair share of the shared queue, never starve other workers.
+                //Partitions are private, nobody else could take them
+                n = sl ? sl->backlog : 1 + (shd ? ShardLen() : qlen) / (cur + 1);
+                if (n > mbt)
+                        n = mbt;
+        }
+        if (shd) {
+                if (!PopShard(home, n, batch))
+                        return false;
+                batches++;
+                return true;
+        }
+        for (u32 i = 0; i < n; i++) {
+                batch.emplace_back();
+                if (!(sl ? PopPartition(sl, batch.back()) : PopTask(batch.back()))) {
+                        batch.pop_back();
+                        break;
+                }
+        }
+        if (batch.empty())
+                return false;
+        batches++;
+        return true;
+}
+
+bool ThreadPoolExecutor::PopTask(Task &t)
+{//this is already guarded by a lock
+        //every tenant in rr_q has pending works, visit each at most once
+        for (size_t n = rr_q.size(); n > 0; n--) {
+                Tenant &tn = tenants[rr_q.front()];
+                if (tn.cap != 0 && tn.act >= tn.cap) {
+                        //tenant is at its limit, keep its deficit and skip it
+                        rr_q.splice(rr_q.end(), rr_q, rr_q.begin());
+                        continue;
+                }
+                if (tn.deficit == 0)
+                        tn.deficit = tn.weight;//start a new round
+                t = std::move(tn.req_q.front());
+                tn.req_q.pop_front();
+                tn.deficit--;
+                tn.act++;
+                tn.served++;
+                served++;
+                qlen--;
+                if (qlen == 0 && state == QUITTING) {
+                        //those sleeping on limits may have eaten the quit posts
+                        for (; cwt > 0; cwt--)
+                                sem.post();
+                }
+                if (tn.req_q.empty()) {
+                        tn.deficit = 0;
+                        rr_q.pop_front();
+                } else if (tn.deficit == 0) {
+                        rr_q.splice(rr_q.end(), rr_q, rr_q.begin());
+                }
+                return true;
+        }
+        return false;
+}
+
+void ThreadPoolExecutor::FinishTask(const Task &t)
+{//this is already guarded by a lock
+        if (t.part != NONE) {
+                parts[t.part].busy--;
+                return;
+        }
+        Tenant &tn = tenants[t.tenant];
+        bool capped = tn.cap != 0 && tn.act >= tn.cap;
+        tn.act--;
+        //a worker may have consumed the post of a blocked work and gone back
+        //to sleep, give the work another chance now that the tenant has room
+        if (capped && !tn.req_q.empty() && cwt > 0) {
+                cwt--;
+                sem.post();
+        }
+}
+
+void ThreadPoolExecutor::DropQueued(std::vector<std::function<void()> > &out)
+{//this is already guarded by a lock
+        for (auto &tp : tenants) {
+                Tenant &tn = tp.second;
+                for (auto &t : tn.req_q)
+                        out.push_back(std::move(t.fn));
+                tn.req_q.clear();
+                tn.deficit = 0;
+        }
+        rr_q.clear();
+        for (auto &pt : parts) {
+                for (auto &t : pt.req_q)
+                        out.push_back(std::move(t.fn));
+                pt.req_q.clear();
+        }
+        for (auto &sl : slots) {
+                sl->ready.clear();
+                sl->backlog = 0;
+        }
+        for (auto &sh : shards) {
+                std::lock_guard<std::mutex> lk(sh->lock);
+                for (auto &t : sh->req_q)
+                        out.push_back(std::move(t.fn));
+                sh->req_q.clear();
+                sh->len = 0;
+        }
+        qlen = 0;
+}
+
+bool ThreadPoolExecutor::SetExceptionHandler(const ExceptionHandler &handler)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        exh = handler;
+        return true;
+}
+
+void ThreadPoolExecutor::Fail(const char *name)
+{
+        failed++;
+        ExceptionHandler h;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                h = exh;
+        }
+        if (!h)
+                return;
+        try {
+                h(std::current_exception(), name);
+        } catch (...) {
+        }
+}
+
+ThreadPoolExecutor *ThreadPoolExecutor::Current()
+{
+        return tl_permit ? tl_permit->pool : nullptr;
+}
+
+bool ThreadPoolExecutor::RunQueued(bool ownBatch)
+{
+        Permit *pm = tl_permit;
+        if (qbd.load(std::memory_order_relaxed) || !slots.empty())
+                return false;
+        //the rest of our own batch first, nobody else can get at it. It is
+        //accounted with the batch, the worker skips what we ran
+        if (pm && pm->pool == this) {
+                auto &batch = *(std::vector<Task> *)pm->batch;
+                if (pm->next < batch.size()) {
+                        Task &t = batch[pm->next++];
+                        std::function<void()> fn = std::move(t.fn);
+                        t.fn = nullptr;
+                        RunHelped(t, fn);
+                        return true;
+                }
+        }
+        if (ownBatch)
+                return false;
+        Task t;
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                if (!shards.empty()) {
+                        std::vector<Task> one;
+                        if (!PopShard(0, 1, one))
+                                return false;
+                        t = std::move(one[0]);
+                } else {
+                        if (!PopTask(t))
+                                return false;
+                        //the post of the work would wake a worker for nothing
+                        if (state == RUNNING)
+                                sem.trywait(1);
+                }
+        }
+        Trace(Tracer::DEQUEUE, t.name);
+        RunHelped(t, t.fn);
+        t.fn = nullptr;
+        std::lock_guard<std::mutex> lk(lock);
+        FinishTask(t);
+        return true;
+}
+
+void ThreadPoolExecutor::RunHelped(const Task &t, const std::function<void()> &fn)
+{
+        Permit *pm = tl_permit;
+        bool recorded = wrc.load(std::memory_order_acquire) && t.enq != 0;
+        u64 t0 = recorded ? now_ns() : 0;
+        u64 h0 = pm ? pm->helped : 0;
+        Trace(Tracer::RUN_BEGIN, t.name);
+        try {
+                fn();
+        } catch (...) {
+                Fail(t.name);
+        }
+        Trace(Tracer::RUN_END, t.name);
+        if (!recorded)
+                return;
+        u64 t1 = now_ns();
+        //like the worker: the works we helped with are recorded on their own
+        u64 nested = pm ? pm->helped - h0 : 0;
+        wrec->Record(t.enq, t0, t1 - nested, t.sub, t.tenant);
+        if (pm)
+                pm->helped = h0 + (t1 - t0);
+}
+
+Arena *ThreadPoolExecutor::CurrentArena()
+{
+        return tl_arena;
+}
+
+bool ThreadPoolExecutor::SetLifoWakeup(bool on)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        sem.setlifo(on);
+        return true;
+}
+
+bool ThreadPoolExecutor::SetSpinWait(u32 spinUs, u32 hotWorkers)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING)
+                return false;
+        spns = (u64)spinUs * 1000;
+        hot = hotWorkers;
+        //spinners pick up the new budget the next time they wait
+        sem.kick();
+        for (auto &sl : slots)
+                sl->sem.kick();
+        return true;
+}
+
+bool ThreadPoolExecutor::SetCpuArbiter(CpuArbiter *a, u32 weight)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || a == nullptr || (arb && arb != a))
+                return false;
+        a->Register(this, weight);
+        arb = a;
+        return true;
+}
+
+bool ThreadPoolExecutor::SetMaxBatch(u32 n)
+{
+        std::lock_guard<std::mutex> lk(lock);
+        if (state != RUNNING || n == 0)
+                return false;
+        mbt = n;
         return true;
 }
 
@@ -177,16 +1287,67 @@ bool ThreadPoolExecutor::SetDestructorTimeout(u32 tm)
         return true;
 }
 
-void ThreadPoolExecutor::InternalWorkerFunction(ThreadPoolExecutor *self)
+void ThreadPoolExecutor::InternalWorkerFunction(ThreadPoolExecutor *self, u32 slot,
+                                                RunSlot *rs)
 {
-        enum {WAIT, WORK, SUICIDE} todo = WAIT;
+        enum {WAIT, WORK, DROP, SUICIDE} todo = WAIT;
+        //partition workers sleep on their own semaphore and only serve the
+        //partitions they own
+        Slot *sl = (slot == NONE) ? nullptr : self->slots[slot].get();
+        Semaphore &sem = sl ? sl->sem : self->sem;
+        bool shd = !self->shards.empty();
+        u32 home = shd ? rs->id % self->shards.size() : 0;
+        PerfCounters pc;
+        u64 pv0[PerfCounters::COUNT], pv1[PerfCounters::COUNT];
+        bool pok = self->prf && pc.Open();
+        Arena arena(self->tattr.arenaSize);
+        if (self->tattr.arenaSize != 0)
+                tl_arena = &arena;
+        //works taken in one go, finished ones are accounted together with
+        //taking the next batch
+        std::vector<Task> batch;
+        //works left by Shutdown(true), dropped by the last worker
+        std::vector<std::function<void()> > dropped;
+        bool hotw = false;//spinning without a budget
+        Permit pm = {self, nullptr, false, &batch, 0, 0};
+        tl_permit = &pm;
+        self->Trace(Tracer::SPAWN);
         while (1) {
-                std::function<void()> work;
-                //return false means we are not freed, we timeouted
-                bool timeout = !self->sem.wait(self->atm);
+                bool timeout = false;
+                //producers of a sharded pool only post when they see us idle,
+                //look once more after telling them
+                bool again = false, woke = false;
+                if (todo == WAIT && shd) {
+                        self->sidle++;
+                        if (self->ShardLen() != 0) {
+                                self->sidle--;
+                                again = true;
+                        }
+                }
+                if (todo == WAIT && !again) {
+                        //return false means we are not freed, we timeouted
+                        self->Trace(Tracer::PARK);
+                        timeout = !sem.wait(self->atm, hotw ? ~0ULL : self->spns.load());
+                        self->Trace(Tracer::UNPARK);
+                        if (shd) {
+                                self->sidle--;
+                                woke = true;
+                        }
+                }
                 {
                         std::lock_guard<std::mutex> lk(self->lock);
                         assert(self->state != DEAD);
+                        if (hotw) {
+                                self->hts--;
+                                hotw = false;
+                        }
+                        if (todo == WORK) {
+                                for (auto &work : batch)
+                                        self->FinishTask(work);
+                                batch.clear();
+                                self->act--;
+                                assert(self->act >= 0);
+                        }
                         /*
                           conditions for WORK:
                           1. there are some work in list
@@ -199,20 +1360,44 @@ void ThreadPoolExecutor::InternalWorkerFunction(ThreadPoolExecutor *self)
                           2. exceeding max limit
                           3. (no work) and timeout
                          */
-                        bool list_empty = self->req_q.empty();
-                        bool exceed_limit = (self->cur > self->max);
+                        bool list_empty = sl ? (sl->backlog == 0)
+                                : shd ? (self->ShardLen() == 0) : (self->qlen == 0);
+                        bool exceed_limit = (self->cur > self->Limit());
                         bool quick_quit = (self->state == QUITTING) && self->qbd;
                         bool quite_idle = timeout && list_empty && self->cur > self->min;
                         bool final_quit = (self->state == QUITTING) && list_empty;
-                        if (!list_empty && !exceed_limit && !quick_quit) {
+                        if (!list_empty && !exceed_limit && !quick_quit
+                            && self->PopBatch(sl, home, batch)) {
                                 //WORK
                                 todo = WORK;
-                                work = self->req_q.front();
-                                self->req_q.pop_front();
                                 self->act++;
+                                if (self->arb.load(std::memory_order_relaxed))
+                                        self->awt++;
+                                if (self->adm.load(std::memory_order_relaxed))
+                                        self->Observe(batch);
                                 assert(self->act != 0);
+                                //the posts of the extra works would only wake
+                                //others for nothing. Quit posts must not be
+                                //eaten, so only while RUNNING. Sharded
+                                //producers do not post per work
+                                if (batch.size() > 1 && self->state == RUNNING && !shd)
+                                        sem.trywait(batch.size() - 1);
+                        } else if (quick_quit && self->cur == 1 && todo != DROP) {
+                                //DROP
+                                //the queued works would only go with the
+                                //pool, release them while it is still there.
+                                //Nothing runs or comes in anymore
+                                self->DropQueued(dropped);
+                                todo = DROP;
                         } else if (exceed_limit || quite_idle || quick_quit || final_quit) {
                                 //SUICIDE
+                                //last chance to touch self, pool may be gone
+                                //as soon as the lock is released
+                                self->Trace(Tracer::EXIT);
+                                //never leave a compensation behind
+                                if (rs->comp.exchange(false))
+                                        self->Unblock();
+                                self->runs.erase(rs->it);
                                 self->cur--;
                                 if (self->cur == 0 && self->state == QUITTING) {
                                         self->state = DEAD;
@@ -221,19 +1406,112 @@ void ThreadPoolExecutor::InternalWorkerFunction(ThreadPoolExecutor *self)
                                 todo = SUICIDE;
                         } else {
                                 //WAIT
+                                if (!list_empty && !sl)
+                                        self->cwt++;
+                                //nothing queued means nothing waits too long
+                                if (list_empty && self->ovl) {
+                                        self->ovl = false;
+                                        self->amin = ~0ULL;
+                                }
+                                if (self->hts < self->hot) {
+                                        self->hts++;
+                                        hotw = true;
+                                }
                                 todo = WAIT;
                         }
                 }
+                if (woke) {
+                        //our wakeup is only taken off once we looked at the
+                        //shards, producers do not wake a second worker for
+                        //the work we are about to pick up. Other posts may
+                        //have woken us too, never go below 0
+                        int sg = self->ssig.load();
+                        while (sg > 0 && !self->ssig.compare_exchange_weak(sg, sg - 1))
+                                ;
+                }
                 if (todo == WORK) {
-                        work();
-                        {
-                                std::lock_guard<std::mutex> lk(self->lock);
-                                self->act--;
-                                assert(self->act >= 0);
+                        CpuArbiter *ca = self->arb.load(std::memory_order_relaxed);
+                        if (ca) {
+                                //false once the pool is shut down, run anyway
+                                pm.arb = ca;
+                                pm.held = ca->Acquire(self);
+                                self->awt--;
                         }
-                } else if (todo == SUICIDE)
+                        for (size_t i = 0; i < batch.size(); i++) {
+                                Task &work = batch[i];
+                                //Shutdown(true) drops the rest of the batch
+                                //just like the works still in the queue, not
+                                //under the lock, they may call back into us
+                                if (i != 0 && self->qbd.load(std::memory_order_relaxed)) {
+                                        for (; i < batch.size(); i++)
+                                                batch[i].fn = nullptr;
+                                        break;
+                                }
+                                //already run by a waiter of an earlier work
+                                if (!work.fn)
+                                        continue;
+                                pm.next = i + 1;
+                                self->Trace(Tracer::DEQUEUE, work.name);
+                                self->Trace(Tracer::RUN_BEGIN, work.name);
+                                bool sampled = self->prf.load(std::memory_order_relaxed);
+                                if (sampled) {
+                                        if (!pc.IsOpen())
+                                                pok = pc.Open();
+                                        pc.Read(pv0);
+                                }
+                                bool watched = self->wdg.load(std::memory_order_relaxed);
+                                //works put before recording have no stamp
+                                //acquire, wrec is set before wrc
+                                bool recorded = self->wrc.load(std::memory_order_acquire)
+                                        && work.enq != 0;
+                                u64 t0 = (watched || recorded) ? now_ns() : 0;
+                                u64 h0 = pm.helped;
+                                if (watched) {
+                                        rs->name.store(work.name, std::memory_order_relaxed);
+                                        rs->start.store(t0, std::memory_order_release);
+                                }
+                                //zero cost until something throws, the
+                                //worker and its accounting go on either way
+                                try {
+                                        work.fn();
+                                } catch (...) {
+                                        self->Fail(work.name);
+                                }
+                                //without the works run while it waited
+                                if (recorded)
+                                        self->wrec->Record(work.enq, t0,
+                                                           now_ns() - (pm.helped - h0),
+                                                           work.sub, work.tenant);
+                                //the closure may hold resources, release them now
+                                work.fn = nullptr;
+                                //pairs with comp then start of the watchdog
+                                if (watched)
+                                        rs->start.store(0);
+                                arena.Reset();
+                                self->Trace(Tracer::RUN_END, work.name);
+                                if (sampled) {
+                                        pc.Read(pv1);
+                                        std::lock_guard<std::mutex> lk(self->lock);
+                                        self->pavl |= pok;
+                                        self->AccountPerf(work.name, pv0, pv1);
+                                }
+                                if (rs->comp.load() && rs->comp.exchange(false)) {
+                                        std::lock_guard<std::mutex> lk(self->lock);
+                                        self->Unblock();
+                                }
+                        }
+                        pm.next = batch.size();
+                        //one permit per batch, other pools get their turn
+                        if (pm.held) {
+                                pm.arb->Release(self);
+                                pm.held = false;
+                        }
+                } else if (todo == DROP) {
+                        dropped.clear();
+                } else if (todo == SUICIDE) {
+                        tl_arena = nullptr;
+                        tl_permit = nullptr;
                         return;
-                else
-                        continue;
+                }
         }
 }
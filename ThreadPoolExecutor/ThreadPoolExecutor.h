@@ -11,72 +11,243 @@
 #include <chrono>
 #include <cassert>
 #include <functional>
+#include <map>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <exception>
+#include "Executor.h"
 
 typedef unsigned int u32;
+typedef unsigned long long u64;
+
+class Tracer;
+class WorkloadRecorder;
+class Arena;
+class CpuArbiter;
+
+//tell the cpu we are in a spin loop
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+}
+
 class Semaphore {
 public:
-        inline Semaphore() : cnt(0) {}
+        inline Semaphore()
+                : cnt(0), top(nullptr), bottom(nullptr), lifo(true), spn(0),
+                  hand(0), gen(0) {}
         //~Semaphore(); use default
         inline void post() {
                 std::lock_guard<std::mutex> lk(lock);
+                if (spn > 0) {
+                        //a spinner picks it up without any wakeup
+                        hand++;
+                        return;
+                }
                 cnt++;
                 if (cnt <= 0)
-                        cv.notify_one();
+                        Wake(lifo ? top : bottom);
+        }
+        /*
+          take up to n without blocking, return how many were taken
+         */
+        inline u32 trywait(u32 n) {
+                std::lock_guard<std::mutex> lk(lock);
+                u32 got = (cnt > 0) ? ((u32)cnt < n ? (u32)cnt : n) : 0;
+                cnt -= got;
+                while (got < n && TakeHand())
+                        got++;
+                return got;
+        }
+        //stop every spinner now, they park as usual
+        inline void kick() {
+                gen++;
         }
         inline void notify_all() {
                 std::lock_guard<std::mutex> lk(lock);
                 if (cnt < 0) {
                         cnt = 0;
-                        cv.notify_all();
+                        while (top)
+                                Wake(top);
                 }
         }
+        /*
+          true: post() wakes the waiter that parked last, it is likely still
+          cache hot and the ones at the bottom sleep on until they time out.
+          false: the one waiting for the longest time, work rotates over all
+         */
+        inline void setlifo(bool on) {
+                std::lock_guard<std::mutex> lk(lock);
+                lifo = on;
+        }
         /*
           return true is no timeout happened, condition satisfied, we get a chance to move
           return false if timeout happened
          */
-        inline bool wait(u32 sec) {
+        inline bool wait(u32 sec, u64 spinNs = 0) {
                 std::unique_lock<std::mutex> lk(lock);
+                if (spinNs != 0 && cnt <= 0) {
+                        //poll without the lock for up to spinNs, backing
+                        //off from 1 to 64 pauses between the polls
+                        spn++;
+                        lk.unlock();
+                        bool got = Spin(spinNs);
+                        lk.lock();
+                        spn--;
+                        if (!got)
+                                got = TakeHand();
+                        if (spn == 0) {
+                                //nobody left to pick them up, wake parked ones
+                                for (; hand > 0; hand--)
+                                        if (++cnt <= 0)
+                                                Wake(lifo ? top : bottom);
+                        }
+                        if (got)
+                                return true;
+                }
                 cnt--;
                 if (cnt < 0) {
+                        //park on the top of the idle stack
+                        Parker pk;
+                        pk.up = nullptr;
+                        pk.down = top;
+                        pk.woken = false;
+                        if (top)
+                                top->up = &pk;
+                        else
+                                bottom = &pk;
+                        top = &pk;
                         if (sec != 0) {
-                                auto r = cv.wait_for(lk, std::chrono::seconds(sec));
-                                if (r == std::cv_status::timeout) {
+                                auto until = std::chrono::steady_clock::now()
+                                        + std::chrono::seconds(sec);
+                                if (!pk.cv.wait_until(lk, until, [&pk] {return pk.woken;})) {
                                         //we are not freed, so we free ourselves
+                                        Unlink(&pk);
                                         cnt++;
                                         return false;
                                 }
                         } else {
-                                cv.wait(lk);
+                                pk.cv.wait(lk, [&pk] {return pk.woken;});
                         }
                 }
                 return true;
         }
 private:
-        //a semaphore can be implemented using a condition_variable and a lock
+        //parking slot of one waiter, lives on the waiter's stack
+        struct Parker {
+                std::condition_variable cv;
+                Parker *up, *down;
+                bool woken;
+        };
+        inline void Unlink(Parker *pk) {
+                (pk->up ? pk->up->down : top) = pk->down;
+                (pk->down ? pk->down->up : bottom) = pk->up;
+        }
+        inline void Wake(Parker *pk) {
+                Unlink(pk);
+                pk->woken = true;
+                pk->cv.notify_one();
+        }
+        inline bool TakeHand() {
+                int h = hand.load(std::memory_order_relaxed);
+                while (h > 0)
+                        if (hand.compare_exchange_weak(h, h - 1))
+                                return true;
+                return false;
+        }
+        inline bool Spin(u64 ns) {
+                u64 g = gen;
+                //~0 spins until kicked
+                auto until = (ns == ~0ULL) ? std::chrono::steady_clock::time_point::max()
+                        : std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+                u32 backoff = 1;
+                while (gen == g) {
+                        if (TakeHand())
+                                return true;
+                        for (u32 i = 0; i < backoff; i++)
+                                cpu_relax();
+                        if (backoff < 64)
+                                backoff <<= 1;
+                        else
+                                std::this_thread::yield();//share a busy core
+                        if (std::chrono::steady_clock::now() >= until)
+                                break;
+                }
+                return false;
+        }
+        //a semaphore can be implemented using a condition_variable and a lock,
+        //here one condition_variable per waiter so we pick who is woken
         std::mutex lock;
-        std::condition_variable cv;
         int cnt;//beging negative means some thread is waiting on the internal
                 //condition_variable, otherwise(cnt>=0) means no one is waiting
+        Parker *top, *bottom;//idle stack, -cnt waiters when cnt < 0
+        bool lifo;
+        int spn;//spinning waiters
+        std::atomic<int> hand;//posts left for the spinners, polled lock free
+        std::atomic<u64> gen;//bumped by kick()
 };
 
+/*
+  how worker threads are created, every field left at its default keeps the
+  OS default. Workers are created with pthread attributes built from this.
+ */
+struct ThreadAttributes {
+        ThreadAttributes()
+                : stackSize(0), guardSize(0), policy(-1), priority(0), nice(0),
+                  arenaSize(64 * 1024) {}
+        size_t stackSize;//bytes, rounded up to PTHREAD_STACK_MIN, 0 for default
+        size_t guardSize;//bytes, 0 for default
+        std::string name;//workers are named "<name>-<id>", cut to the OS limit
+        int policy;//SCHED_OTHER, SCHED_FIFO ... -1 to inherit
+        int priority;//sched_priority used with policy
+        int nice;//Linux only, per thread nice value, 0 keeps the inherited one
+        size_t arenaSize;//scratch arena chunk of each worker, 0 for no arena
+        std::function<void()> onStart;//run by each worker before its first work
+        std::function<void()> onExit;//run by each worker after it left the pool
+};
 
-class ThreadPoolExecutor {
+class ThreadPoolExecutor : public Executor {
 public:
         //factory method: create a thread pool with a limited concurrency
-        static inline ThreadPoolExecutor *NewFixedThreadPool(u32 nThreads) {
-                return new ThreadPoolExecutor(nThreads, nThreads, 0);
+        static inline ThreadPoolExecutor *NewFixedThreadPool(u32 nThreads,
+                const ThreadAttributes &attr = ThreadAttributes()) {
+                return new ThreadPoolExecutor(nThreads, nThreads, 0, attr);
         }
         //factory method: create a pool with only 1 single worker thread
-        static inline ThreadPoolExecutor *NewSingleThreadExecutor() {
-                return new ThreadPoolExecutor(1, 1, 0);
+        static inline ThreadPoolExecutor *NewSingleThreadExecutor(
+                const ThreadAttributes &attr = ThreadAttributes()) {
+                return new ThreadPoolExecutor(1, 1, 0, attr);
         }
         //factory method: create a pool with unlimited concurrency
         //but usually the OS has a limit, if you add too many task
         //too quickly, you get error from OS telling you that there
-        //is not enough resources
-        static inline ThreadPoolExecutor *NewCachedThreadPool() {
-                return new ThreadPoolExecutor(0, 0xffffffff, 60);//max
+        //is not enough resources. A small attr.stackSize lets many more
+        //threads fit in memory
+        static inline ThreadPoolExecutor *NewCachedThreadPool(
+                const ThreadAttributes &attr = ThreadAttributes()) {
+                return new ThreadPoolExecutor(0, 0xffffffff, 60, attr);//max
         }
+        //factory method: create a fixed pool in partitioned mode. Works put
+        //with ExecuteByKey() are hashed to one of nPartitions partitions and
+        //every partition is owned by exactly one worker, so all works of a key
+        //run in order on the same thread. nPartitions == 0 means 4 per thread
+        static ThreadPoolExecutor *NewPartitionedThreadPool(u32 nThreads,
+                u32 nPartitions = 0, const ThreadAttributes &attr = ThreadAttributes());
+        //factory method: create a fixed pool whose submissions bypass the
+        //pool lock. Works go to one of nShards queues, each with its own
+        //lock, a producer picks the shorter of two random ones. A worker looks
+        //at its home shard first, then at the others. For many threads calling
+        //Execute() at once. Tenants are ignored, every work counts as tenant 0.
+        //nShards == 0 means one per 4 workers, at least 2
+        static ThreadPoolExecutor *NewShardedThreadPool(u32 nThreads,
+                u32 nShards = 0, const ThreadAttributes &attr = ThreadAttributes());
 
         /*
           this is the constructor, usually you do no need to call this unless
@@ -99,8 +270,11 @@ public:
           shrink.
           NOTE: if alive_sec == 0, it means there is no timeout. Idle threads would
           always be kept alive
+
+          attr: stack size, name, scheduling and hooks of worker threads
          */
-        ThreadPoolExecutor(u32 minSize, u32 maxSize, u32 alive_sec)
+        ThreadPoolExecutor(u32 minSize, u32 maxSize, u32 alive_sec,
+                           const ThreadAttributes &attr = ThreadAttributes())
                 : min(minSize),
                   max(maxSize),
                   cur(0),
@@ -108,7 +282,45 @@ public:
                   atm(alive_sec),
                   qbd(false),
                   dtm(0),
-                  state(RUNNING) {
+                  state(RUNNING),
+                  qlen(0),
+                  cwt(0),
+                  served(0),
+                  rbt(0),
+                  kctr(0),
+                  rebalances(0),
+                  blk(0),
+                  cmp(256),
+                  trc(false),
+                  tracer(nullptr),
+                  wrc(false),
+                  wrec(nullptr),
+                  prf(false),
+                  pavl(false),
+                  wid(0),
+                  wdg(false),
+                  wstop(false),
+                  qrep(false),
+                  stalls(0),
+                  adm(false),
+                  ovl(false),
+                  aend(0),
+                  amin(~0ULL),
+                  alast(0),
+                  overloads(0),
+                  rejected(0),
+                  diverted(0),
+                  failed(0),
+                  tattr(attr),
+                  mbt(16),
+                  batches(0),
+                  spns(0),
+                  hot(0),
+                  hts(0),
+                  arb(nullptr),
+                  awt(0),
+                  sidle(0),
+                  ssig(0) {
                           assert(maxSize != 0);
                           assert(minSize <= maxSize);
                           if (minSize > maxSize)
@@ -167,7 +379,8 @@ public:
         /*
           asap(as soon as possible) measn quit even if work queue is not empty
           otherwise pool threads would quit only when current work queue is empty
-          i.e. all works are done
+          i.e. all works are done. The works dropped by asap are destroyed
+          unrun by the last thread to quit, before AwaitTermination() returns
          */
         void Shutdown(bool asap=false);
         /*
@@ -189,8 +402,279 @@ public:
           fun is work function.
           use this API to add work into the threadpool request queue
          */
-        bool Execute(const std::function<void()> &task);
+        bool Execute(const std::function<void()> &task) final;
+        //name: optional static name of the work, shown in traces
+        bool Execute(const std::function<void()> &task, const char *name);
+        /*
+          same as above, but the work is tagged with a tenant id. Every tenant
+          has its own sub-queue and idle workers pick the next work from those
+          sub-queues in weighted round robin order(deficit round robin with unit
+          cost), so a tenant flooding the pool can not starve the others.
+          Execute(task) is the same as Execute(0, task). Tenants that were never
+          configured by SetTenant() get weight 1 and no active limit.
+          name: optional static name of the work, shown in traces
+         */
+        bool Execute(u32 tenant, const std::function<void()> &task,
+                     const char *name = nullptr);
+        /*
+          put all works in one go, taking the pool lock only once. Useful for
+          event sources that produce many works at a time
+         */
+        bool ExecuteBatch(const std::vector<std::function<void()> > &tasks,
+                          u32 tenant = 0);
+        /*
+          weight: how many works of this tenant are dispatched per round, must
+          be greater than 0
+          maxActive: maximum number of workers that can run works of this
+          tenant at the same time, 0 means no limit
+          return false when weight is 0 or when pool is quitting
+         */
+        bool SetTenant(u32 tenant, u32 weight, u32 maxActive = 0);
+        /*
+          partitioned mode only: put the work into the private queue of the
+          worker owning the partition of key. Works of the same key never run
+          concurrently and are run in the order they are put.
+          In partitioned mode Execute() spreads keyless works over partitions
+          and tenants are ignored.
+          return false when the pool is quitting or not partitioned
+         */
+        bool ExecuteByKey(u64 key, const std::function<void()> &task,
+                          const char *name = nullptr);
+        /*
+          partitioned mode only: when a worker has more than threshold pending
+          works, hand one of its other idle partitions to the least loaded
+          worker. Ordering of every key is kept because a partition only
+          moves while none of its works is running. 0 disables rebalancing
+         */
+        bool SetRebalanceThreshold(u32 threshold);
         bool SetDestructorTimeout(u32 tm);
+        /*
+          scratch arena of the calling worker, reset after every work, see
+          Arena.h. nullptr when not called from a worker or when workers were
+          created with a 0 arenaSize
+         */
+        static Arena *CurrentArena();
+        /*
+          a worker takes up to n works per lock acquisition and runs them
+          in a row. The actual batch adapts to the queue depth, roughly the
+          queue length divided by pool size, so short queues are still spread
+          over all workers. 1 disables batching, so does a watchdog that
+          compensates stalls.
+          return false when n is 0 or when pool is quitting
+         */
+        bool SetMaxBatch(u32 n);
+        /*
+          idle workers park on a stack, a new work wakes the one that went
+          idle last. It is still cache hot, and under partial load the rest
+          sleep long enough for the keep alive time to reap them. Default on,
+          off wakes the longest idle worker so works rotate over all of them.
+          return false when pool is quitting
+         */
+        bool SetLifoWakeup(bool on);
+        /*
+          low latency mode: an idle worker polls for new works for up to
+          spinUs microseconds before it parks, so a work put meanwhile starts
+          without any wakeup. hotWorkers of them never park at all and keep a
+          core each busy while idle. Both can be changed at any time, 0 and 0
+          (the default) parks at once.
+          return false when pool is quitting
+         */
+        bool SetSpinWait(u32 spinUs, u32 hotWorkers = 0);
+        /*
+          share a core budget with the other pools attached to arb, see
+          CpuArbiter. A worker then holds a permit of arb for every batch it
+          runs. Can be called again with the same arb to change the weight.
+          return false when pool is quitting or attached to another arbiter
+         */
+        bool SetCpuArbiter(CpuArbiter *arb, u32 weight = 1);
+        /*
+          run blocker, a call expected to block for a long time(disk, locks,
+          waiting for other works), from inside a work of this pool. While it
+          blocks the pool may run one more worker than max, so a fixed pool
+          does not silently lose a core. The extra worker retires once the
+          blocked work resumes and it finds itself over the limit.
+          In partitioned mode there is no compensation, blocker is just run.
+         */
+        void ManagedBlock(const std::function<void()> &blocker);
+        /*
+          same as ManagedBlock() but for code that can not be put in a
+          function, every BeginBlocking() must be paired with EndBlocking()
+         */
+        void BeginBlocking();
+        void EndBlocking();
+        /*
+          maximum number of extra workers started to compensate blocked ones,
+          0 disables compensation
+         */
+        bool SetCompensationLimit(u32 n);
+        //the pool whose worker is the calling thread, nullptr for others
+        static ThreadPoolExecutor *Current();
+        /*
+          run one pending work on the calling thread, for a worker that
+          waits on something pending works may produce, see Sync.h. A worker
+          first takes the works left in its own batch, with ownBatch only
+          those. Works of a partitioned pool keep their order and are never
+          taken.
+          return false when nothing was pending or the pool is shut down
+          with Shutdown(true)
+         */
+        bool RunQueued(bool ownBatch = false);
+
+        /*
+          tracing mode: every thread touching the pool records enqueue,
+          dequeue, run begin/end, park/unpark and spawn/exit events into its
+          own ring buffer of ringSize events. ringSize only matters for the
+          first call. When tracing is off the cost is one predictable branch
+          per event point.
+         */
+        bool EnableTracing(u32 ringSize = 65536);
+        void DisableTracing();
+        /*
+          write recorded events as Chrome trace-event JSON, open it with
+          chrome://tracing or ui.perfetto.dev
+          return false when tracing was never enabled or on I/O error
+         */
+        bool FlushTrace(const char *path);
+
+        /*
+          workload recording: every work is recorded with its arrival time,
+          queueing delay, running time, the thread that put it and its
+          tenant, to replay the real traffic against other pool
+          configurations with ReplayWorkload() of Workload.h. At most
+          maxRecords are kept, only the first call sets it. When recording is
+          off the cost is one predictable branch per work.
+         */
+        bool EnableWorkloadRecording(u32 maxRecords = 1 << 20);
+        void DisableWorkloadRecording();
+        /*
+          write the recorded works in the binary trace format of Workload.h
+          return false when recording was never enabled or on I/O error
+         */
+        bool FlushWorkload(const char *path);
+
+        /*
+          per worker performance counters: every worker opens cycles,
+          instructions, LLC misses, context switches and CPU migrations
+          counters for itself with perf_event_open(2) and samples them around
+          every work. Counts are summed per work name and reported by
+          GetStats(). When the OS does not permit perf events the works still
+          run and the counts stay 0, see Stats.perfAvailable.
+          return false when pool is quitting
+         */
+        bool EnablePerfCounters(bool on = true);
+
+        struct StallInfo {
+                u32 worker;//id of the stalled worker, 0xffffffff for the queue
+                const char *name;//name of the stalled work, may be nullptr
+                u64 elapsedMs;//running time of the work or age of oldest queued work
+        };
+        struct WatchdogConfig {
+                WatchdogConfig()
+                        : intervalMs(100), runMs(0), queueMs(0), compensate(false) {}
+                u32 intervalMs;//how often the watchdog checks
+                u32 runMs;//report works running longer than this, 0 means never
+                u32 queueMs;//report when the oldest queued work is older, 0 means never
+                bool compensate;//treat a stalled work as inside ManagedBlock()
+                std::function<void(const StallInfo &)> onStall;
+        };
+        /*
+          start a watchdog thread checking every intervalMs for works running
+          too long and for works waiting too long in the queue. onStall is
+          called from the watchdog thread, without any pool lock held, once
+          per stalled work and once each time the queue goes over its limit.
+          Calling it again replaces the config of the running watchdog.
+          return false when intervalMs is 0 or when pool is quitting
+         */
+        bool EnableWatchdog(const WatchdogConfig &cfg);
+
+        struct AdmissionConfig {
+                AdmissionConfig() : targetUs(5000), intervalMs(100) {}
+                u32 targetUs;//acceptable queueing delay, 0 turns admission off
+                u32 intervalMs;//window the minimum delay is taken over
+                //gets the refused works on the calling thread, e.g. to answer
+                //them with a busy reply or run a cheaper path. It is called
+                //inside Execute() with no lock of the pool held, and must
+                //run the work, now or later, or let it be destroyed. A
+                //Strand drops its pending works with a dropped turn, a
+                //Pipeline needs every work it puts run
+                std::function<void(const std::function<void()> &)> onReject;
+        };
+        /*
+          CoDel style admission control. Works are stamped when put and
+          workers take the minimum time they spent queued over every
+          interval. A minimum above targetUs means the queue never drained
+          during a whole interval: a standing queue, not a burst. The pool is
+          then overloaded and refuses new works, whatever they cost, until
+          an interval's minimum is back under target or a worker finds the
+          queue empty. A refused work makes Execute() return false, or is
+          handed to onReject when set and Execute() returns true.
+          return false when intervalMs is 0 or when pool is quitting
+         */
+        bool SetAdmissionControl(const AdmissionConfig &cfg);
+
+        typedef std::function<void(std::exception_ptr e, const char *name)> ExceptionHandler;
+        /*
+          an exception escaping a work is caught by the worker, which goes on
+          with its next work, see Stats.failed. handler gets every such
+          exception on the worker, with the name of the work and no pool
+          lock held, an exception of handler itself is dropped. Works put
+          with Submit() never get here, their future has the exception.
+          return false when pool is quitting
+         */
+        bool SetExceptionHandler(const ExceptionHandler &handler);
+
+        struct PerfStats {
+                const char *name;//work name, "" for unnamed works
+                u64 works;
+                u64 cycles;
+                u64 instructions;
+                u64 llcMisses;
+                u64 ctxSwitches;
+                u64 migrations;
+        };
+        struct TenantStats {
+                u32 tenant;
+                u32 weight;
+                u32 maxActive;
+                u32 queued;//number of works waiting in the sub-queue
+                u32 active;//number of works of this tenant currently running
+                u64 served;//number of works of this tenant dispatched so far
+                double share;//served / all works dispatched so far
+        };
+        struct PartitionStats {
+                u32 worker;//index of the owning worker
+                u32 queued;//backlog of this partition
+                u64 served;
+        };
+        struct AdmissionStats {
+                bool enabled;
+                bool overloaded;
+                u64 minSojournUs;//minimum queueing delay of the last interval
+                u64 overloads;//times the pool went overloaded
+                u64 rejected;//works refused, Execute() returned false
+                u64 diverted;//works handed to onReject
+        };
+        struct Stats {
+                u32 poolSize;
+                u32 activeCount;
+                u32 queued;
+                u64 served;
+                std::vector<TenantStats> tenants;
+                std::vector<PartitionStats> partitions;
+                u64 rebalances;//partitions moved between workers
+                u32 blocked;//works inside ManagedBlock()
+                std::vector<PerfStats> perf;
+                bool perfAvailable;//some worker could open a counter
+                u64 stalls;//stalls reported by the watchdog
+                u64 batches;//batches taken by workers, served / batches is
+                            //the average batch size
+                AdmissionStats admission;
+                u64 failed;//works that threw
+        };
+        /*
+          take a consistent snapshot of the pool counters
+         */
+        Stats GetStats();
 private:
         std::mutex lock;
         u32 min;//minium number of threads, may not hold true for initial stage
@@ -200,17 +684,182 @@ private:
         u32 cur;//current number of threads
         u32 act;//current number of threads that is working(not idle)
         u32 atm;//alive timeout in seconds
-        bool qbd;//quit before all works done
+        std::atomic<bool> qbd;//quit before all works done
         u32 dtm;//destructor AwaitTermination timeout in seconds , 0 means forever
         enum {RUNNING, QUITTING, DEAD} state;
         std::condition_variable quitCond;//used to implement AwaitTermination()
         Semaphore sem;//used to control thread activity
-        //request list
-        std::list<std::function<void()> > req_q;
-        //worker thread function
-        static void InternalWorkerFunction(ThreadPoolExecutor *pool);
+        struct Task {
+                std::function<void()> fn;
+                const char *name;
+                u32 tenant;
+                u32 part;//partition, NONE for works of the shared queue
+                u64 enq;//time put, only stamped while the watchdog, the
+                        //admission control or the recording runs
+                u32 sub;//id of the thread that put it, while recording
+        };
+        static const u32 NONE = 0xffffffff;
+        struct Tenant {
+                Tenant() : weight(1), cap(0), act(0), deficit(0), served(0) {}
+                u32 weight;//quantum per round
+                u32 cap;//maximum active works, 0 means no limit
+                u32 act;//active works
+                u32 deficit;//works still allowed in current round
+                u64 served;
+                //request list of this tenant
+                std::list<Task> req_q;
+        };
+        std::map<u32, Tenant> tenants;
+        std::list<u32> rr_q;//tenants having pending works, in round robin order
+        u32 qlen;//total number of pending works of all tenants
+        u32 cwt;//workers that went back to sleep because every pending work
+                //belongs to a tenant at its active limit
+        u64 served;//total number of works dispatched
+        //partitioned mode
+        struct Partition {
+                Partition() : owner(0), busy(0), served(0) {}
+                u32 owner;//index of owning worker
+                u32 busy;//works taken by the owner and not finished yet
+                u64 served;
+                std::list<Task> req_q;
+        };
+        struct Slot {
+                Slot() : backlog(0) {}
+                Semaphore sem;//private semaphore of the owning worker
+                u32 backlog;//pending works in owned partitions
+                std::list<u32> ready;//owned partitions having pending works
+        };
+        std::vector<Partition> parts;
+        std::vector<std::unique_ptr<Slot> > slots;//empty if not partitioned
+        u32 rbt;//rebalance threshold
+        u32 kctr;//key counter for keyless works
+        u64 rebalances;
+        //works inside ManagedBlock(), changed under lock. Sharded
+        //producers read it without
+        std::atomic<u32> blk;
+        u32 cmp;//compensation limit
+        //max raised by compensation, guarded by lock
+        inline u32 Limit() const {
+                u32 b = blk.load(std::memory_order_relaxed);
+                u32 extra = (b < cmp) ? b : cmp;
+                return (max > 0xffffffff - extra) ? 0xffffffff : max + extra;
+        }
+        //tracer and wrec are set once, before their flag goes up, and live
+        //as long as the pool. Whoever follows them loads the flag acquire
+        std::atomic<bool> trc;//tracing enabled
+        Tracer *tracer;
+        inline void Trace(int type, const char *name = nullptr);
+        std::atomic<bool> wrc;//workload recording enabled
+        WorkloadRecorder *wrec;
+        std::atomic<bool> prf;//perf counters enabled
+        bool pavl;
+        struct StrLess {
+                bool operator()(const char *a, const char *b) const {
+                        return strcmp(a, b) < 0;
+                }
+        };
+        std::map<const char *, PerfStats, StrLess> pstats;
+        //add the difference of two samples to the stats of name, guarded by lock
+        inline void AccountPerf(const char *name, const u64 *v0, const u64 *v1);
+        //watchdog
+        struct RunSlot {
+                u32 id;
+                std::atomic<u64> start;//start time of the running work, 0 if idle
+                std::atomic<const char *> name;
+                u64 reported;//start time of the last reported work
+                std::atomic<bool> comp;//compensated like ManagedBlock()
+                std::list<RunSlot>::iterator it;
+        };
+        std::list<RunSlot> runs;//one per worker
+        u32 wid;//next worker id
+        std::atomic<bool> wdg;//watchdog running
+        bool wstop;
+        bool qrep;//queue stall reported
+        u64 stalls;
+        WatchdogConfig wcfg;
+        std::condition_variable wcv;
+        std::thread wdt;
+        void WatchdogLoop();
+        inline u64 OldestEnqueue();
+        //admission control
+        std::atomic<bool> adm;//enabled
+        std::atomic<bool> ovl;//overloaded, read without the lock
+        AdmissionConfig acfg;
+        u64 aend;//end of the current interval
+        u64 amin;//minimum delay in the current interval, ~0 for no sample
+        u64 alast;//minimum delay of the last interval
+        u64 overloads;
+        std::atomic<u64> rejected;
+        std::atomic<u64> diverted;
+        inline u64 Stamp();
+        //refuse or divert a work, no lock held
+        bool Shed(const std::function<void()> &task);
+        //take the delays of a new batch, guarded by lock
+        inline void Observe(const std::vector<Task> &batch);
+        std::atomic<u64> failed;
+        ExceptionHandler exh;
+        //count the exception being handled and pass it on, no lock held
+        void Fail(const char *name);
+        //run a work for RunQueued(), traced and recorded, no lock held
+        void RunHelped(const Task &t, const std::function<void()> &fn);
+        //guarded parts of BeginBlocking()/EndBlocking()
+        inline void Block();
+        inline void Unblock();
+        //start a worker for pending works no idle worker can take while
+        //some are blocked, this is already guarded by a lock
+        void Compensate();
+        ThreadAttributes tattr;
+        u32 mbt;//max batch
+        u64 batches;
+        std::atomic<u64> spns;//spin budget of idle workers, ns
+        u32 hot;//workers allowed to spin without a budget
+        u32 hts;//workers spinning without a budget now
+        std::atomic<CpuArbiter *> arb;
+        //workers holding works while they wait for a permit of arb. More
+        //threads would only wait as well, the pool does not grow meanwhile.
+        //Raised under lock
+        std::atomic<u32> awt;
+        //sharded mode
+        struct Shard {
+                Shard() : len(0), closed(false) {}
+                std::mutex lock;
+                std::list<Task> req_q;
+                std::atomic<u32> len;//read without the lock
+                bool closed;//refuse new works, guarded by lock
+                char pad[64];//producers of a neighbour never touch our line
+        };
+        std::vector<std::unique_ptr<Shard> > shards;//empty if not sharded
+        std::atomic<int> sidle;//workers parked or about to park
+        std::atomic<int> ssig;//wakeups posted and not yet picked up
+        inline bool PushShard(const std::function<void()> *tasks, size_t n,
+                              const char *name);
+        inline u32 ShardLen();
+        //take up to n works, home shard first, guarded by lock
+        inline bool PopShard(u32 home, u32 n, std::vector<Task> &batch);
+        //thread entry, runs the worker function then the exit hook
+        static void *ThreadEntry(void *arg);
+        //worker thread function, slot is NONE for workers of the shared queue
+        static void InternalWorkerFunction(ThreadPoolExecutor *pool, u32 slot,
+                                           RunSlot *rs);
+        //guarded by lock
+        inline void Enqueue(u32 tenant, const std::function<void()> &task,
+                            const char *name);
+        inline bool PopPartition(Slot *sl, Task &t);
+        inline void PushPartition(u32 p, const std::function<void()> &task,
+                                  const char *name);
+        inline void Rebalance(u32 from, u32 hot);
+        //pick next work in deficit round robin order, guarded by lock
+        inline bool PopTask(Task &t);
+        //take the next batch of works for a worker, guarded by lock.
+        //home: the shard looked at first in sharded mode
+        inline bool PopBatch(Slot *sl, u32 home, std::vector<Task> &batch);
+        //account the end of a work, guarded by lock
+        inline void FinishTask(const Task &t);
+        //take every queued work out for Shutdown(true) to drop, guarded by
+        //lock. Their destructors may call back into us, run them without
+        void DropQueued(std::vector<std::function<void()> > &out);
         //internally used to add one thread to threadpool
-        inline void Add1Thread();
+        inline void Add1Thread(u32 slot = NONE);
         //make sure that this call is already guarded by a lock
         inline void CommonCleanup();
 };
@@ -0,0 +1,104 @@
+#include "Trace.h"
+
+static std::atomic<u64> tracer_gen(1);
+//ring of the calling thread in the tracer it last recorded into
+static thread_local u64 tl_gen = 0;
+static thread_local void *tl_ring = nullptr;
+
+Tracer::Tracer(u32 ringSize)
+        : gen(tracer_gen++),
+          t0(std::chrono::steady_clock::now())
+{
+        u32 n = 16;
+        while (n < ringSize && n < 0x80000000)
+                n <<= 1;
+        mask = n - 1;
+}
+
+Tracer::~Tracer()
+{
+        for (auto &it : rings)
+                delete it.second;
+}
+
+Tracer::Ring *Tracer::GetRing()
+{
+        if (tl_gen == gen)
+                return (Ring *)tl_ring;
+        std::lock_guard<std::mutex> lk(lock);
+        Ring *&r = rings[std::this_thread::get_id()];
+        if (r == nullptr) {
+                r = new Ring();
+                r->tid = rings.size();
+                r->head = 0;
+                r->evs.resize(mask + 1);
+        }
+        tl_gen = gen;
+        tl_ring = r;
+        return r;
+}
+
+void Tracer::Record(Type type, const char *name)
+{
+        Ring *r = GetRing();
+        u64 h = r->head.load(std::memory_order_relaxed);
+        Event &ev = r->evs[h & mask];
+        ev.ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+        ev.name = name;
+        ev.type = type;
+        r->head.store(h + 1, std::memory_order_release);
+}
+
+static void put_name(std::ostream &out, const char *name)
+{
+        out << '"';
+        for (const char *p = name; *p; p++) {
+                if (*p == '"' || *p == '\\')
+                        out << '\\';
+                if ((unsigned char)*p >= 0x20)
+                        out << *p;
+        }
+        out << '"';
+}
+
+void Tracer::Flush(std::ostream &out)
+{
+        static const char *tnames[] = {
+                "enqueue", "dequeue", "run", "run", "park", "unpark", "spawn", "exit"
+        };
+        std::lock_guard<std::mutex> lk(lock);
+        bool first = true;
+        out << "{\"traceEvents\":[";
+        for (auto &it : rings) {
+                Ring *r = it.second;
+                u64 h = r->head.load(std::memory_order_acquire);
+                u64 b = (h > mask + 1) ? h - mask - 1 : 0;
+                out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << r->tid
+                    << ",\"name\":\"thread_name\",\"args\":{\"name\":\"thread " << r->tid << "\"}}";
+                first = false;
+                bool open = false;
+                for (u64 i = b; i < h; i++) {
+                        const Event &ev = r->evs[i & mask];
+                        const char *ph = "i";
+                        if (ev.type == RUN_BEGIN) {
+                                ph = "B";
+                                open = true;
+                        } else if (ev.type == RUN_END) {
+                                //the begin was overwritten, drop the lone end
+                                if (!open)
+                                        continue;
+                                ph = "E";
+                                open = false;
+                        }
+                        out << ",\n{\"ph\":\"" << ph << "\",\"pid\":1,\"tid\":" << r->tid
+                            << ",\"ts\":" << ev.ts / 1000 << "." << ev.ts / 100 % 10
+                            << ",\"cat\":\"" << tnames[ev.type] << "\",\"name\":";
+                        put_name(out, ev.name ? ev.name : tnames[ev.type]);
+                        if (*ph == 'i')
+                                out << ",\"s\":\"t\"";
+                        out << "}";
+                }
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
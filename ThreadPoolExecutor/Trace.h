@@ -0,0 +1,45 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <atomic>
+#include <ostream>
+#include "ThreadPoolExecutor.h"
+
+/*
+  Event recorder used by ThreadPoolExecutor in tracing mode. Every thread
+  touching the pool records into its own fixed size ring buffer, the owner
+  thread is the only writer so recording takes no lock. When a ring is full
+  the oldest events are overwritten. Flush() writes every ring as Chrome
+  trace-event JSON, loadable by chrome://tracing or Perfetto. Flushing while
+  threads are still recording may show a few torn events at the ring edges.
+ */
+class Tracer {
+public:
+        enum Type {ENQUEUE, DEQUEUE, RUN_BEGIN, RUN_END, PARK, UNPARK, SPAWN, EXIT};
+        //ringSize: events kept per thread, rounded up to a power of 2
+        explicit Tracer(u32 ringSize);
+        ~Tracer();
+        //record one event of the calling thread, name must be static
+        void Record(Type type, const char *name);
+        void Flush(std::ostream &out);
+private:
+        struct Event {
+                u64 ts;//nanoseconds
+                const char *name;
+                Type type;
+        };
+        struct Ring {
+                u32 tid;
+                std::atomic<u64> head;//number of events ever recorded
+                std::vector<Event> evs;
+        };
+        u64 gen;//identifies this tracer in the per-thread cache
+        u32 mask;
+        std::chrono::steady_clock::time_point t0;
+        std::mutex lock;//guards rings, only taken the first time a thread records
+        std::map<std::thread::id, Ring *> rings;
+        Ring *GetRing();
+};
@@ -0,0 +1,280 @@
+#include "Workload.h"
+#include <algorithm>
+#include <cstdio>
+
+static const char MAGIC[8] = {'T', 'P', 'E', 'W', 'K', 'L', 'D', '1'};
+
+static std::atomic<u64> recorder_gen(1);
+//buffer of the calling thread in the recorder it last recorded into
+static thread_local u64 tl_gen = 0;
+static thread_local void *tl_buf = nullptr;
+
+static inline u64 now_ns()
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct WorkloadRecorder::Buf {
+        std::mutex lock;//only contended while Collect() copies it
+        std::vector<WorkloadRecord> recs;
+};
+
+WorkloadRecorder::WorkloadRecorder(u32 maxRecords)
+        : gen(recorder_gen++),
+          t0(now_ns()),
+          max(maxRecords),
+          taken(0),
+          dropped(0)
+{
+}
+
+WorkloadRecorder::~WorkloadRecorder()
+{
+        for (auto b : bufs)
+                delete b;
+}
+
+WorkloadRecorder::Buf *WorkloadRecorder::GetBuf()
+{
+        if (tl_gen == gen)
+                return (Buf *)tl_buf;
+        std::lock_guard<std::mutex> lk(lock);
+        Buf *b = new Buf();
+        bufs.push_back(b);
+        tl_gen = gen;
+        tl_buf = b;
+        return b;
+}
+
+void WorkloadRecorder::Record(u64 enq, u64 start, u64 end, u32 submitter, u32 tenant)
+{
+        //put before recording started
+        if (enq < t0)
+                return;
+        if (taken.fetch_add(1, std::memory_order_relaxed) >= max) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+        }
+        Buf *b = GetBuf();
+        WorkloadRecord r = {enq - t0, start - enq, end - start, submitter, tenant};
+        std::lock_guard<std::mutex> lk(b->lock);
+        b->recs.push_back(r);
+}
+
+void WorkloadRecorder::Collect(std::vector<WorkloadRecord> &out, u64 &ndropped)
+{
+        out.clear();
+        {
+                std::lock_guard<std::mutex> lk(lock);
+                for (auto b : bufs) {
+                        std::lock_guard<std::mutex> blk(b->lock);
+                        out.insert(out.end(), b->recs.begin(), b->recs.end());
+                }
+        }
+        std::sort(out.begin(), out.end(),
+                  [] (const WorkloadRecord &a, const WorkloadRecord &b) {
+                          return a.arrival < b.arrival;
+                  });
+        ndropped = dropped;
+}
+
+static void put_varint(std::string &s, u64 v)
+{
+        while (v >= 0x80) {
+                s += (char)(v | 0x80);
+                v >>= 7;
+        }
+        s += (char)v;
+}
+
+static bool get_varint(const unsigned char *&p, const unsigned char *end, u64 &v)
+{
+        v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+                u64 c = *p++;
+                v |= (c & 0x7f) << shift;
+                if (!(c & 0x80))
+                        return true;
+        }
+        return false;
+}
+
+bool WriteWorkload(const char *path, const std::vector<WorkloadRecord> &recs)
+{
+        std::vector<const WorkloadRecord *> byArrival;
+        for (auto &r : recs)
+                byArrival.push_back(&r);
+        std::stable_sort(byArrival.begin(), byArrival.end(),
+                         [] (const WorkloadRecord *a, const WorkloadRecord *b) {
+                                 return a->arrival < b->arrival;
+                         });
+        std::string s(MAGIC, sizeof(MAGIC));
+        u64 n = recs.size();
+        s.append((const char *)&n, sizeof(n));
+        u64 prev = 0;
+        for (auto r : byArrival) {
+                put_varint(s, r->arrival - prev);
+                put_varint(s, r->wait);
+                put_varint(s, r->run);
+                put_varint(s, r->submitter);
+                put_varint(s, r->tenant);
+                prev = r->arrival;
+        }
+        FILE *f = fopen(path, "wb");
+        if (f == nullptr)
+                return false;
+        bool ok = fwrite(s.data(), 1, s.size(), f) == s.size();
+        return (fclose(f) == 0) && ok;
+}
+
+bool ReadWorkload(const char *path, std::vector<WorkloadRecord> &recs)
+{
+        recs.clear();
+        FILE *f = fopen(path, "rb");
+        if (f == nullptr)
+                return false;
+        std::string s;
+        char buf[65536];
+        size_t got;
+        while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+                s.append(buf, got);
+        bool err = ferror(f);
+        fclose(f);
+        u64 n;
+        if (err || s.size() < sizeof(MAGIC) + sizeof(n)
+            || s.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0)
+                return false;
+        memcpy(&n, s.data() + sizeof(MAGIC), sizeof(n));
+        const unsigned char *p = (const unsigned char *)s.data() + sizeof(MAGIC) + sizeof(n);
+        const unsigned char *end = (const unsigned char *)s.data() + s.size();
+        //every record takes at least 5 bytes, a bad count can not blow up
+        if (n > (u64)(end - p) / 5)
+                return false;
+        recs.reserve(n);
+        u64 prev = 0;
+        for (u64 i = 0; i < n; i++) {
+                u64 v[5];
+                for (int k = 0; k < 5; k++)
+                        if (!get_varint(p, end, v[k]))
+                                return false;
+                prev += v[0];
+                WorkloadRecord r = {prev, v[1], v[2], (u32)v[3], (u32)v[4]};
+                recs.push_back(r);
+        }
+        return p == end;
+}
+
+//a replayed work, counted as dropped when the pool destroys it unrun
+struct Fate {
+        explicit Fate(std::atomic<u64> *ad) : dropped(ad), ran(false) {}
+        ~Fate() {
+                if (!ran)
+                        (*dropped)++;
+        }
+        std::atomic<u64> *dropped;
+        bool ran;//or refused, counted by the feeder
+};
+
+ReplayReport ReplayWorkload(ThreadPoolExecutor *pool,
+                            const std::vector<WorkloadRecord> &recs,
+                            double speed)
+{
+        ReplayReport rp;
+        memset(&rp, 0, sizeof(rp));
+        if (recs.empty())
+                return rp;
+        if (!(speed > 0))
+                speed = 1.0;
+        std::map<u32, std::vector<size_t> > subs;
+        u64 first = ~0ULL;
+        for (size_t i = 0; i < recs.size(); i++) {
+                subs[recs[i].submitter].push_back(i);
+                first = std::min(first, recs[i].arrival);
+        }
+        rp.submitters = subs.size();
+        //delays of accepted works, ~0 for refused ones
+        std::vector<u64> waits(recs.size(), ~0ULL);
+        std::atomic<u64> done(0), refused(0), dropped(0), last(0);
+        std::atomic<u32> feeding(subs.size());
+        //give every feeder the time to start before the first arrival
+        u64 base = now_ns() + 10 * 1000 * 1000;
+        std::vector<std::thread> feeders;
+        for (auto &it : subs) {
+                const std::vector<size_t> *idx = &it.second;
+                feeders.emplace_back([&, idx] () {
+                                for (size_t i : *idx) {
+                                        const WorkloadRecord &r = recs[i];
+                                        u64 due = base + (u64)((r.arrival - first) / speed);
+                                        u64 now;
+                                        while ((now = now_ns()) < due) {
+                                                //sleeping oversleeps, only for long gaps
+                                                if (due - now > 200 * 1000)
+                                                        std::this_thread::sleep_for(
+                                                                std::chrono::nanoseconds(due - now - 100 * 1000));
+                                                else
+                                                        std::this_thread::yield();
+                                        }
+                                        u64 put = now;
+                                        u64 run = (u64)(r.run / speed);
+                                        u64 *w = &waits[i];
+                                        auto f = std::make_shared<Fate>(&dropped);
+                                        bool ok = pool->Execute(r.tenant, [put, run, w, f, &done, &last] () {
+                                                        f->ran = true;
+                                                        u64 s = now_ns();
+                                                        *w = s - put;
+                                                        //busy, like the recorded work
+                                                        u64 e;
+                                                        while ((e = now_ns()) < s + run)
+                                                                cpu_relax();
+                                                        u64 l = last.load();
+                                                        while (l < e && !last.compare_exchange_weak(l, e))
+                                                                ;
+                                                        done++;
+                                                });
+                                        if (!ok) {
+                                                f->ran = true;
+                                                refused++;
+                                        }
+                                }
+                                feeding--;
+                        });
+        }
+        //sample the thread counts until every accepted work ran or was
+        //dropped
+        u64 samples = 0, threads = 0;
+        while (feeding > 0 || done + refused + dropped < recs.size()) {
+                u32 sz = pool->GetPoolSize(), act = pool->GetActiveCount();
+                rp.peakThreads = std::max(rp.peakThreads, sz);
+                rp.peakActive = std::max(rp.peakActive, act);
+                threads += sz;
+                samples++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (auto &t : feeders)
+                t.join();
+        std::vector<u64> ws;
+        ws.reserve(done);
+        for (u64 w : waits)
+                if (w != ~0ULL)
+                        ws.push_back(w);
+        std::sort(ws.begin(), ws.end());
+        rp.works = ws.size();
+        rp.dropped = dropped;
+        u64 start = base;
+        rp.seconds = last > start ? (last - start) / 1e9 : 0;
+        rp.throughput = rp.seconds > 0 ? rp.works / rp.seconds : 0;
+        auto pct = [&ws] (double p) {
+                if (ws.empty())
+                        return 0.0;
+                size_t i = std::min(ws.size() - 1, (size_t)(p * ws.size()));
+                return ws[i] / 1e3;
+        };
+        rp.waitP50 = pct(0.5);
+        rp.waitP90 = pct(0.9);
+        rp.waitP99 = pct(0.99);
+        rp.waitP999 = pct(0.999);
+        rp.waitMax = ws.empty() ? 0 : ws.back() / 1e3;
+        rp.avgThreads = samples ? (double)threads / samples : 0;
+        return rp;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Local Variables:
+// mode: c++
+// End:
+
+#include <atomic>
+#include <string>
+#include "ThreadPoolExecutor.h"
+
+/*
+  Workload traces: what a ThreadPoolExecutor in recording mode saw of its
+  traffic, and a replay of such a trace against any pool, to try another
+  pool configuration or scheduling policy on real traffic before using it.
+ */
+struct WorkloadRecord {
+        u64 arrival;//ns since recording started
+        u64 wait;//ns queued before a worker took it
+        u64 run;//ns running
+        u32 submitter;//small id of the thread that put the work
+        u32 tenant;
+};
+
+/*
+  Collects the records of a pool in recording mode. Every worker appends to
+  its own buffer under a lock of that buffer, which only Collect() contends
+  for. At most maxRecords are kept, the works after those are only counted.
+  A work run by a waiting worker(see ThreadPoolExecutor::RunQueued()) is
+  recorded on its own, and its time is taken off the work that waited.
+ */
+class WorkloadRecorder {
+public:
+        explicit WorkloadRecorder(u32 maxRecords);
+        ~WorkloadRecorder();
+        //record one work run by the calling thread, times are steady clock ns
+        void Record(u64 enq, u64 start, u64 end, u32 submitter, u32 tenant);
+        //every record so far sorted by arrival, and the number dropped
+        void Collect(std::vector<WorkloadRecord> &out, u64 &dropped);
+private:
+        struct Buf;
+        u64 gen;//identifies this recorder in the per-thread cache
+        u64 t0;
+        u32 max;
+        std::atomic<u64> taken;//records handed out to buffers
+        std::atomic<u64> dropped;
+        std::mutex lock;//guards bufs, only taken the first time a thread records
+        std::vector<Buf *> bufs;
+        Buf *GetBuf();
+};
+
+/*
+  binary trace file: the magic "TPEWKLD1", the number of records as a u64,
+  then the records by arrival, every field a LEB128 varint and the arrival a
+  delta to the previous one. A typical work takes 8 to 12 bytes.
+  return false on I/O error, or a file that is not a whole trace
+ */
+bool WriteWorkload(const char *path, const std::vector<WorkloadRecord> &recs);
+bool ReadWorkload(const char *path, std::vector<WorkloadRecord> &recs);
+
+struct ReplayReport {
+        u64 works;
+        double seconds;//first arrival to last completion
+        double throughput;//works per second
+        //queueing delay percentiles in the replay, us
+        double waitP50;
+        double waitP90;
+        double waitP99;
+        double waitP999;
+        double waitMax;
+        u32 peakThreads;//pool size, sampled every ms
+        double avgThreads;
+        u32 peakActive;//busy workers, sampled every ms
+        u32 submitters;
+        u64 dropped;//accepted by the pool and dropped unrun
+};
+
+/*
+  feed a trace into pool: one feeder thread per recorded submitter puts its
+  works at their recorded arrival times, divided by speed, with the recorded
+  tenant. Every work busy-waits its recorded running time. Returns once every
+  work has run or was dropped unrun, the pool is left running. Works the
+  pool refuses or drops are not counted in works
+ */
+ReplayReport ReplayWorkload(ThreadPoolExecutor *pool,
+                            const std::vector<WorkloadRecord> &recs,
+                            double speed = 1.0);
@@ -4,7 +4,7 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE    := jni
 LOCAL_C_INCLUDES := ThreadPoolExecutor
-LOCAL_SRC_FILES := jni.cpp ThreadPoolExecutor/TestThreadPoolExecutor.cc ThreadPOolExecutor/ThreadPOolExecutor.cc
+LOCAL_SRC_FILES := jni.cpp ThreadPoolExecutor/TestThreadPoolExecutor.cc ThreadPOolExecutor/ThreadPOolExecutor.cc ThreadPoolExecutor/Strand.cc ThreadPoolExecutor/Reactor.cc ThreadPoolExecutor/Trace.cc ThreadPoolExecutor/PerfCounters.cc ThreadPoolExecutor/Arena.cc ThreadPoolExecutor/Pipeline.cc ThreadPoolExecutor/CpuArbiter.cc ThreadPoolExecutor/Executor.cc ThreadPoolExecutor/DurableQueue.cc ThreadPoolExecutor/Workload.cc ThreadPoolExecutor/Sync.cc
 
 LOCAL_CFLAGS += -std=c++11 -g -ggdb -O0 -pthread
 #LOCAL_CFLAGS += -std=c++11
@@ -0,0 +1,5 @@
+int main(int argc, char **argv)
+{
+	extern int bmain(int argc, char **argv);
+	return bmain(argc, argv);
+}
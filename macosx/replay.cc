@@ -0,0 +1,5 @@
+int main(int argc, char **argv)
+{
+	extern int rmain(int argc, char **argv);
+	return rmain(argc, argv);
+}